@@ -0,0 +1,155 @@
+#include <limits.h>
+#include "aggregate-kernel.h"
+#include "simd.h"
+
+static const uint32_t KERNEL_BATCH_SIZE = 1024;
+
+// readers of the value types kernels are specialized on.
+// each one reads values of given rows (1 based) of a field into a batch,
+// and has the min and max returned for empty row sets.
+
+// int fields, widened to int64 so sums do not overflow
+struct IntReader {
+  typedef int64_t Value;
+  static const int64_t emptyMin = INT_MAX;
+  static const int64_t emptyMax = INT_MIN;
+
+  static void gather(Field *field, const uint32_t *rows, uint32_t count, Value *values) {
+    field->storage.ivals.gather(rows, count, values);
+  }
+};
+
+// bsi encoded int fields
+struct BsiReader {
+  typedef int64_t Value;
+  static const int64_t emptyMin = INT_MAX;
+  static const int64_t emptyMax = INT_MIN;
+
+  static void gather(Field *field, const uint32_t *rows, uint32_t count, Value *values) {
+    for (uint32_t j = 0; j < count; j++) {
+      values[j] = field->storage.bsi->getValue(rows[j]);
+    }
+  }
+};
+
+struct TimestampReader {
+  typedef int64_t Value;
+  static const int64_t emptyMin = INT64_MAX;
+  static const int64_t emptyMax = INT64_MIN;
+
+  static void gather(Field *field, const uint32_t *rows, uint32_t count, Value *values) {
+    field->storage.timestamps.gather(rows, count, values);
+  }
+};
+
+struct BigintReader {
+  typedef uint64_t Value;
+  static const uint64_t emptyMin = UINT64_MAX;
+  static const uint64_t emptyMax = 0;
+
+  static void gather(Field *field, const uint32_t *rows, uint32_t count, Value *values) {
+    const auto &u64vals = field->storage.u64vals;
+
+    for (uint32_t j = 0; j < count; j++) {
+      values[j] = u64vals[rows[j] - 1];
+    }
+  }
+};
+
+// folds a batch into the aggregates asked. min and max use the vectorized
+// helpers, which sum in the same pass. a lone sum is a plain loop the compiler vectorizes.
+template <int kinds>
+static inline void fold(const int64_t *values, uint32_t count, int64_t &min, int64_t &max, uint64_t &sum) {
+  if (kinds & (FIELD_AGGR_MIN | FIELD_AGGR_MAX)) {
+    simdAggregate(values, count, &min, &max, &sum);
+  } else if (kinds & FIELD_AGGR_SUM) {
+    for (uint32_t j = 0; j < count; j++) {
+      sum += (uint64_t) values[j];
+    }
+  }
+}
+
+template <int kinds>
+static inline void fold(const uint64_t *values, uint32_t count, uint64_t &min, uint64_t &max, uint64_t &sum) {
+  if (kinds & (FIELD_AGGR_MIN | FIELD_AGGR_MAX)) {
+    simdAggregateUnsigned(values, count, &min, &max, &sum);
+  } else if (kinds & FIELD_AGGR_SUM) {
+    for (uint32_t j = 0; j < count; j++) {
+      sum += values[j];
+    }
+  }
+}
+
+template <typename Reader, int kinds>
+static void scanKernel(Field *field, roaring_bitmap_t *bitmap, FieldAggregate &result,
+                       const function<void(const int64_t *values, uint32_t count)> &fn) {
+  typename Reader::Value min = Reader::emptyMin;
+  typename Reader::Value max = Reader::emptyMax;
+  uint64_t sum = 0;
+  uint32_t rows[KERNEL_BATCH_SIZE];
+  typename Reader::Value values[KERNEL_BATCH_SIZE];
+  roaring_uint32_iterator_t *it = roaring_create_iterator(bitmap);
+
+  for (uint32_t count; (count = roaring_read_uint32_iterator(it, rows, KERNEL_BATCH_SIZE)) > 0; ) {
+    Reader::gather(field, rows, count, values);
+    fold<kinds>(values, count, min, max, sum);
+
+    if (fn) {
+      fn((const int64_t *) values, count);
+    }
+  }
+
+  roaring_free_uint32_iterator(it);
+
+  result.min = (uint64_t) min;
+  result.max = (uint64_t) max;
+  result.sum = sum;
+}
+
+// bit slices answer aggregates of bsi fields without reading rows
+template <int kinds>
+static void bsiKernel(Field *field, roaring_bitmap_t *bitmap, FieldAggregate &result,
+                      const function<void(const int64_t *values, uint32_t count)> &) {
+  if (kinds & FIELD_AGGR_MIN) {
+    result.min = (uint64_t) (int64_t) field->storage.bsi->min(bitmap);
+  }
+
+  if (kinds & FIELD_AGGR_MAX) {
+    result.max = (uint64_t) (int64_t) field->storage.bsi->max(bitmap);
+  }
+
+  if (kinds & FIELD_AGGR_SUM) {
+    result.sum = (uint64_t) field->storage.bsi->sum(bitmap);
+  }
+}
+
+// scanning kernels only differ by whether they fold min and max, a lone sum or nothing
+template <typename Reader>
+static AggregateKernel scanKernelFor(int kinds) {
+  if (kinds & (FIELD_AGGR_MIN | FIELD_AGGR_MAX)) {
+    return scanKernel<Reader, FIELD_AGGR_MIN | FIELD_AGGR_MAX | FIELD_AGGR_SUM>;
+  }
+
+  return kinds & FIELD_AGGR_SUM ? scanKernel<Reader, FIELD_AGGR_SUM> : scanKernel<Reader, 0>;
+}
+
+static const AggregateKernel BSI_KERNELS[] = {
+  bsiKernel<0>, bsiKernel<1>, bsiKernel<2>, bsiKernel<3>,
+  bsiKernel<4>, bsiKernel<5>, bsiKernel<6>, bsiKernel<7>
+};
+
+AggregateKernel findAggregateKernel(int type, int encoding, int kinds, bool readsValues) {
+  kinds &= FIELD_AGGR_MIN | FIELD_AGGR_MAX | FIELD_AGGR_SUM;
+
+  switch (type) {
+    case FIELD_TYPE_INT: {
+      if (encoding == FIELD_ENCODING_BSI) {
+        return readsValues ? scanKernelFor<BsiReader>(kinds) : BSI_KERNELS[kinds];
+      }
+      return scanKernelFor<IntReader>(kinds);
+    }
+    case FIELD_TYPE_TIMESTAMP: return scanKernelFor<TimestampReader>(kinds);
+    case FIELD_TYPE_BIGINT: return scanKernelFor<BigintReader>(kinds);
+    default: return nullptr;
+  }
+}
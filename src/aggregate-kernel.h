@@ -0,0 +1,36 @@
+#include <functional>
+#include <stdint.h>
+#include "roaring/roaring.h"
+#include "field.h"
+
+#ifndef MERLIN_AGGREGATE_KERNEL_H
+#define MERLIN_AGGREGATE_KERNEL_H
+
+using namespace std;
+
+// aggregates asked from an aggregate kernel
+const int FIELD_AGGR_MIN = 1;
+const int FIELD_AGGR_MAX = 2;
+const int FIELD_AGGR_SUM = 4;
+
+// min, max and sum of some rows of a field.
+// values of int and timestamp fields are sign extended.
+struct FieldAggregate {
+  uint64_t min;
+  uint64_t max;
+  uint64_t sum;
+};
+
+// computes aggregates of given rows of a field in a single batched pass.
+// kernels are specialized on the value type of the field and on the aggregates
+// asked, so their loops have no type checks. aggregates not asked are left unset.
+// when set, fn is called with the batches read, sign extended like scanInts does.
+typedef void (*AggregateKernel)(Field *field, roaring_bitmap_t *bitmap, FieldAggregate &result,
+                                const function<void(const int64_t *values, uint32_t count)> &fn);
+
+// kernel for fields of given type and encoding computing kinds, a mask of FIELD_AGGR_* values.
+// readsValues asks for a kernel reading every row, which fn needs.
+// returns nullptr for fields which can not be aggregated.
+AggregateKernel findAggregateKernel(int type, int encoding, int kinds, bool readsValues);
+
+#endif //MERLIN_AGGREGATE_KERNEL_H
@@ -0,0 +1,218 @@
+#include <climits>
+#include <stdexcept>
+#include "bsi.h"
+
+using namespace std;
+
+void BitSlicedIndex::setValue(uint32_t row, int value) {
+  const uint32_t biased = bias(value);
+
+  roaring_bitmap_add(ebm, row);
+
+  for (int i = 0; i < BIT_DEPTH; i++) {
+    if ((biased >> i) & 1) {
+      roaring_bitmap_add(slices[i], row);
+    }
+  }
+}
+
+int BitSlicedIndex::getValue(uint32_t row) const {
+  uint32_t biased = 0;
+
+  for (int i = 0; i < BIT_DEPTH; i++) {
+    if (roaring_bitmap_contains(slices[i], row)) {
+      biased |= 1u << i;
+    }
+  }
+
+  return unbias(biased);
+}
+
+roaring_bitmap_t *BitSlicedIndex::compare(string op, int64_t value, const roaring_bitmap_t *foundSet) {
+  const bool wantLt = op == "<" || op == "<=";
+  const bool wantGt = op == ">" || op == ">=";
+  const bool wantEq = op == "=" || op == "<=" || op == ">=";
+
+  if (!wantLt && !wantGt && !wantEq) {
+    throw std::runtime_error("unsupported operator for bit-sliced index: " + op);
+  }
+
+  auto eq = foundSet != nullptr ? roaring_bitmap_and(ebm, foundSet) : roaring_bitmap_copy(ebm);
+
+  // value is out of our domain, either every row or no row matches
+  if (value > INT_MAX || value < INT_MIN) {
+    if ((value > INT_MAX && !wantLt) || (value < INT_MIN && !wantGt)) {
+      roaring_bitmap_clear(eq);
+    }
+    return eq;
+  }
+
+  const uint32_t biased = bias((int) value);
+  auto lt = roaring_bitmap_create();
+  auto gt = roaring_bitmap_create();
+
+  // walk slices from the most significant bit. "eq" keeps the rows
+  // whose bits seen so far are equal to value's bits. as soon as a row's bit
+  // differs, it is moved to "lt" or "gt".
+  for (int i = BIT_DEPTH - 1; i >= 0; i--) {
+    if (roaring_bitmap_is_empty(eq)) {
+      break;
+    }
+
+    if ((biased >> i) & 1) {
+      if (wantLt) {
+        auto diff = roaring_bitmap_andnot(eq, slices[i]);
+        roaring_bitmap_or_inplace(lt, diff);
+        roaring_bitmap_free(diff);
+      }
+      roaring_bitmap_and_inplace(eq, slices[i]);
+    } else {
+      if (wantGt) {
+        auto diff = roaring_bitmap_and(eq, slices[i]);
+        roaring_bitmap_or_inplace(gt, diff);
+        roaring_bitmap_free(diff);
+      }
+      roaring_bitmap_andnot_inplace(eq, slices[i]);
+    }
+  }
+
+  roaring_bitmap_t *result;
+
+  if (wantLt) {
+    result = lt;
+    roaring_bitmap_free(gt);
+  } else if (wantGt) {
+    result = gt;
+    roaring_bitmap_free(lt);
+  } else {
+    roaring_bitmap_free(lt);
+    roaring_bitmap_free(gt);
+    return eq;
+  }
+
+  if (wantEq) {
+    roaring_bitmap_or_inplace(result, eq);
+  }
+
+  roaring_bitmap_free(eq);
+
+  return result;
+}
+
+roaring_bitmap_t *BitSlicedIndex::between(int64_t from, int64_t to, const roaring_bitmap_t *foundSet) {
+  auto result = compare(">=", from, foundSet);
+
+  if (roaring_bitmap_is_empty(result)) {
+    return result;
+  }
+
+  auto upper = compare("<=", to, result);
+  roaring_bitmap_free(result);
+
+  return upper;
+}
+
+int64_t BitSlicedIndex::sum(const roaring_bitmap_t *foundSet, uint64_t *count) {
+  const uint64_t n = foundSet != nullptr
+                     ? roaring_bitmap_and_cardinality(ebm, foundSet)
+                     : roaring_bitmap_get_cardinality(ebm);
+  uint64_t total = 0;
+
+  if (count != nullptr) {
+    *count = n;
+  }
+
+  if (n == 0) {
+    return 0;
+  }
+
+  for (int i = 0; i < BIT_DEPTH; i++) {
+    const uint64_t card = foundSet != nullptr
+                          ? roaring_bitmap_and_cardinality(slices[i], foundSet)
+                          : roaring_bitmap_get_cardinality(slices[i]);
+    total += card << i;
+  }
+
+  // remove the bias added to every value. unsigned arithmetic wraps,
+  // so the result is right as long as the real sum fits in int64.
+  total -= n << (BIT_DEPTH - 1);
+
+  return (int64_t) total;
+}
+
+bool BitSlicedIndex::extremum(const roaring_bitmap_t *foundSet, bool findMax, uint32_t *result) {
+  auto candidates = foundSet != nullptr ? roaring_bitmap_and(ebm, foundSet) : roaring_bitmap_copy(ebm);
+  uint32_t value = 0;
+
+  if (roaring_bitmap_is_empty(candidates)) {
+    roaring_bitmap_free(candidates);
+    return false;
+  }
+
+  // at each bit prefer the candidates having the wanted bit (1 for max, 0 for min).
+  // if none of them has it, every candidate has the other one.
+  for (int i = BIT_DEPTH - 1; i >= 0; i--) {
+    auto narrowed = findMax
+                    ? roaring_bitmap_and(candidates, slices[i])
+                    : roaring_bitmap_andnot(candidates, slices[i]);
+
+    if (!roaring_bitmap_is_empty(narrowed)) {
+      roaring_bitmap_free(candidates);
+      candidates = narrowed;
+      if (findMax) {
+        value |= 1u << i;
+      }
+    } else {
+      roaring_bitmap_free(narrowed);
+      if (!findMax) {
+        value |= 1u << i;
+      }
+    }
+  }
+
+  roaring_bitmap_free(candidates);
+  *result = value;
+
+  return true;
+}
+
+int BitSlicedIndex::min(const roaring_bitmap_t *foundSet) {
+  uint32_t value;
+
+  if (!extremum(foundSet, false, &value)) {
+    return INT_MAX;
+  }
+
+  return unbias(value);
+}
+
+int BitSlicedIndex::max(const roaring_bitmap_t *foundSet) {
+  uint32_t value;
+
+  if (!extremum(foundSet, true, &value)) {
+    return INT_MIN;
+  }
+
+  return unbias(value);
+}
+
+void BitSlicedIndex::save(SnapshotWriter &writer) const {
+  writer.writeBitmap(ebm);
+
+  for (auto &&slice : slices) {
+    writer.writeBitmap(slice);
+  }
+}
+
+void BitSlicedIndex::load(SnapshotReader &reader) {
+  // replace bitmaps one by one, so the index stays valid if reading fails
+  auto bitmap = reader.readBitmap();
+  roaring_bitmap_free(ebm);
+  ebm = bitmap;
+
+  for (auto &&slice : slices) {
+    bitmap = reader.readBitmap();
+    roaring_bitmap_free(slice);
+    slice = bitmap;
+  }
+}
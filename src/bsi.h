@@ -0,0 +1,79 @@
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "roaring/roaring.h"
+#include "snapshot.h"
+
+#ifndef MERLIN_BSI_H
+#define MERLIN_BSI_H
+
+using namespace std;
+
+// bit-sliced index over 32 bit signed integers.
+// every bit of the (biased) value has its own bitmap,
+// so range predicates and sum/min/max can be answered
+// with bitmap operations instead of touching every row.
+class BitSlicedIndex {
+  public:
+  static const int BIT_DEPTH = 32;
+
+  // rows which have a value
+  roaring_bitmap_t *ebm;
+  // slices[i] holds the rows whose biased value has bit i set
+  vector<roaring_bitmap_t *> slices;
+
+  BitSlicedIndex() {
+    ebm = roaring_bitmap_create();
+    for (int i = 0; i < BIT_DEPTH; i++) {
+      slices.push_back(roaring_bitmap_create());
+    }
+  }
+
+  BitSlicedIndex(const BitSlicedIndex &other) {
+    ebm = roaring_bitmap_copy(other.ebm);
+    for (auto &&slice : other.slices) {
+      slices.push_back(roaring_bitmap_copy(slice));
+    }
+  }
+
+  BitSlicedIndex &operator=(const BitSlicedIndex &) = delete;
+
+  ~BitSlicedIndex() {
+    roaring_bitmap_free(ebm);
+    for (auto &&slice : slices) {
+      roaring_bitmap_free(slice);
+    }
+  }
+
+  void setValue(uint32_t row, int value);
+
+  // value of a row, one lookup per slice
+  int getValue(uint32_t row) const;
+
+  // returns rows matching "<op> value", op is one of =, <, <=, >, >=.
+  // when foundSet is not null, result is limited to it.
+  // caller owns the returned bitmap.
+  roaring_bitmap_t *compare(string op, int64_t value, const roaring_bitmap_t *foundSet = nullptr);
+
+  // returns rows whose value is in [from, to]. caller owns the returned bitmap.
+  roaring_bitmap_t *between(int64_t from, int64_t to, const roaring_bitmap_t *foundSet = nullptr);
+
+  int64_t sum(const roaring_bitmap_t *foundSet, uint64_t *count = nullptr);
+
+  int min(const roaring_bitmap_t *foundSet);
+
+  int max(const roaring_bitmap_t *foundSet);
+
+  void save(SnapshotWriter &writer) const;
+  void load(SnapshotReader &reader);
+
+  private:
+  // signed values are stored with their sign bit flipped,
+  // this way unsigned ordering of slices matches signed ordering of values.
+  static inline uint32_t bias(int value) { return ((uint32_t) value) ^ 0x80000000u; }
+  static inline int unbias(uint32_t value) { return (int) (value ^ 0x80000000u); }
+
+  bool extremum(const roaring_bitmap_t *foundSet, bool findMax, uint32_t *result);
+};
+
+#endif //MERLIN_BSI_H
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <chrono>
+#include <stdlib.h>
+#include "../table.h"
+#include "../query.h"
+#include "../insert-batch.h"
+
+using namespace std;
+
+// compares exact and approximate distinct counts over a column having
+// a distinct value per row, read from rows and from a rollup keeping sketches.
+//
+// usage: bench_count_distinct [rows = 10000000]
+
+static void runDistinctQuery(Table *table, const string &field, const string &func) {
+  Query query(table);
+  query.isAggregationQuery = true;
+  query.selectExprs.push_back(new SelectExpr("*", "count", "rows"));
+  query.selectExprs.push_back(new SelectExpr(field, func, "distinct"));
+  query.selectExprs.push_back(new SelectExpr("timestamp", "dateSecondsGroup", "day"));
+  query.selectExprs.back()->aggerationFuncArgs.push_back("86400");
+  query.groupByExprs.push_back(new GroupByExpr("day"));
+
+  const auto start = chrono::system_clock::now();
+  query.run();
+  chrono::duration<double> elapsed = chrono::system_clock::now() - start;
+
+  uint64_t rows = 0;
+  uint64_t distinct = 0;
+
+  for (auto &&row : query.result.rows) {
+    rows += row->values[0]->u64Val;
+    distinct += row->values[1]->u64Val;
+  }
+
+  cout << "  " << func << "(" << field << ")" << (query.rollup != nullptr ? " from rollup" : "") << ": "
+       << distinct << " of " << rows << " rows, error " << (distinct - (double) rows) / rows * 100 << "%, "
+       << elapsed.count() << " sec, " << query.stats.scratch_bytes << " scratch bytes" << endl;
+}
+
+int main(int argc, char **argv) {
+  const uint32_t rows = argc > 1 ? (uint32_t) strtoul(argv[1], nullptr, 10) : 10000000;
+  const uint32_t batchRows = 100000;
+  auto table = new Table();
+  auto userId = new Field("userId", FIELD_TYPE_STRING);
+  int64_t ts = 1497000000;
+
+  userId->setEncoding(FIELD_ENCODING_DICT);
+  table->setField(new Field("timestamp", FIELD_TYPE_TIMESTAMP));
+  table->setField(userId);
+  table->setField(new Field("sessionId", FIELD_TYPE_BIGINT));
+  table->addRollup(new Rollup("daily", "timestamp", 86400, {}, {{"userId", "approx_count_distinct", 0}}));
+
+  cout << "generating " << rows << " rows, each with a distinct user..." << endl;
+
+  // every row is in the same day, so the day group holds all distinct values
+  for (uint32_t i = 0; i < rows; i += batchRows) {
+    InsertBatch batch;
+    string err;
+
+    batch.rowCount = std::min(batchRows, rows - i);
+    for (auto &&it : table->fields) {
+      batch.fields.push_back(it.first);
+      batch.types.push_back(it.second->type);
+      batch.columns.emplace_back();
+    }
+
+    // fields are ordered by name: sessionId, timestamp, userId
+    for (uint32_t j = i; j < i + batch.rowCount; j++) {
+      batch.columns[0].emplace_back((uint64_t) (j * 2654435761ULL));
+      batch.columns[1].emplace_back((int64_t) (ts + j % 3600));
+      batch.columns[2].emplace_back(string("user-") + to_string(j));
+    }
+
+    if (!batch.apply(table, err)) {
+      cout << err << endl;
+      return 1;
+    }
+  }
+
+  table->compact();
+
+  runDistinctQuery(table, "sessionId", "count_distinct");
+  runDistinctQuery(table, "sessionId", "approx_count_distinct");
+  runDistinctQuery(table, "userId", "count_distinct");
+  runDistinctQuery(table, "userId", "approx_count_distinct");
+
+  delete table;
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <chrono>
+#include <map>
+#include <stdlib.h>
+#include "../field.h"
+
+using namespace std;
+
+// compares per-row roaring_iterate bucketing (the previous implementation)
+// with Field::genGroups batched scan for dateSecondsGroup.
+//
+// usage: bench_date_seconds_group [rows = 50000000] [seconds = 7]
+
+struct legacy_date_seconds_group_data {
+  int64_t seconds;
+  map<int64_t, roaring_bitmap_t *> &result;
+  Field *field;
+};
+
+static bool legacyDateSecondsGroup(uint32_t value, void *data) {
+  const auto *ctx = (legacy_date_seconds_group_data *) data;
+  const auto timestamp = ctx->field->storage.timestamps[value - 1];
+  const int64_t group = timestamp - (timestamp % ctx->seconds);
+  roaring_bitmap_t *roar = nullptr;
+
+  if (ctx->result.count(group) == 1) {
+    roar = ctx->result[group];
+  } else {
+    roar = roaring_bitmap_create();
+    ctx->result[group] = roar;
+  }
+
+  roaring_bitmap_add(roar, value);
+  return true;
+}
+
+static double rowsPerSec(uint64_t rows, chrono::duration<double> elapsed) {
+  return rows / elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  const uint32_t rows = argc > 1 ? (uint32_t) strtoul(argv[1], nullptr, 10) : 50000000;
+  const int64_t seconds = argc > 2 ? strtoll(argv[2], nullptr, 10) : 7;
+  Field field("timestamp", FIELD_TYPE_TIMESTAMP);
+  int64_t timestamp = 1497000000;
+
+  cout << "generating " << rows << " rows..." << endl;
+
+  // roughly time ordered ingest, ~20 events per second with some stragglers
+  for (uint32_t i = 0; i < rows; i++) {
+    if (i % 20 == 0) {
+      timestamp++;
+    }
+    field.addValue(GenericValueContainer(i % 1000 == 0 ? timestamp - rand() % 60 : timestamp));
+  }
+
+  auto allRows = roaring_bitmap_from_range(1, (uint64_t) rows + 1, 1);
+  // every third row, to measure a filtered query too
+  auto filtered = roaring_bitmap_from_range(1, (uint64_t) rows + 1, 3);
+
+  for (auto &&bitmap : {allRows, filtered}) {
+    const auto cardinality = roaring_bitmap_get_cardinality(bitmap);
+    map<int64_t, roaring_bitmap_t *> legacyResult;
+    legacy_date_seconds_group_data ctx = {
+      .seconds = seconds,
+      .result = legacyResult,
+      .field = &field
+    };
+
+    auto start = chrono::system_clock::now();
+    roaring_iterate(bitmap, legacyDateSecondsGroup, (void *) &ctx);
+    chrono::duration<double> legacyElapsed = chrono::system_clock::now() - start;
+
+    start = chrono::system_clock::now();
+    auto groups = field.genGroups(bitmap, "dateSecondsGroup", {to_string(seconds)});
+    chrono::duration<double> batchElapsed = chrono::system_clock::now() - start;
+
+    cout << "rows: " << cardinality << ", groups: " << groups.size() << endl;
+    cout << "  per-row callback: " << (uint64_t) rowsPerSec(cardinality, legacyElapsed) << " rows/sec" << endl;
+    cout << "  batched scan:     " << (uint64_t) rowsPerSec(cardinality, batchElapsed) << " rows/sec" << endl;
+
+    for (auto &&it : legacyResult) {
+      roaring_bitmap_free(it.second);
+    }
+
+    for (auto &&it : groups) {
+      roaring_bitmap_free(it.second);
+    }
+  }
+
+  roaring_bitmap_free(allRows);
+  roaring_bitmap_free(filtered);
+
+  return 0;
+}
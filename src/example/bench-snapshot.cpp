@@ -0,0 +1,144 @@
+#include <iostream>
+#include <chrono>
+#include <map>
+#include <stdlib.h>
+#include "../table.h"
+#include "../snapshot.h"
+#include "../query.h"
+
+using namespace std;
+
+// measures snapshot save and restore throughput of a web log like table,
+// restoring both by copying and by mapping the files.
+//
+// usage: bench_snapshot [rows = 10000000] [dir = bench-snapshot]
+
+// rows having given user agent
+static uint64_t countUserAgent(Table *table, const string &userAgent) {
+  Query query(table);
+  uint64_t count = 0;
+
+  query.isAggregationQuery = true;
+  query.selectExprs = {new SelectExpr("endpoint"), new SelectExpr("*", "count")};
+  query.groupByExprs = {new GroupByExpr("endpoint")};
+  query.filterExprs = {new FilterExpr("userAgent", "=", userAgent)};
+  query.run();
+
+  for (auto &&row : query.result.rows) {
+    count += row->values[1]->getUInt64Val();
+  }
+
+  return count;
+}
+
+// whether raw string values of a restored table match the ones saved
+static bool sameUserAgents(Table *saved, Table *restored) {
+  const auto savedSegments = saved->allSegments();
+  const auto restoredSegments = restored->allSegments();
+
+  if (savedSegments.size() != restoredSegments.size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < savedSegments.size(); i++) {
+    const auto &expected = savedSegments[i]->fields["userAgent"]->storage.strval.raw.arr;
+    const auto &actual = restoredSegments[i]->fields["userAgent"]->storage.strval.raw.arr;
+
+    if (expected.size() != actual.size()) {
+      return false;
+    }
+
+    for (size_t row = 0; row < expected.size(); row++) {
+      if (expected[row] != actual[row]) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static double megabytesPerSec(int64_t bytes, chrono::duration<double> elapsed) {
+  return bytes / elapsed.count() / (1 << 20);
+}
+
+int main(int argc, char **argv) {
+  const uint32_t rows = argc > 1 ? (uint32_t) strtoul(argv[1], nullptr, 10) : 10000000;
+  const string dir = argc > 2 ? argv[2] : "bench-snapshot";
+  map<string, Table *> tables;
+  auto table = new Table();
+  auto timestamp = new Field("timestamp", FIELD_TYPE_TIMESTAMP);
+  auto endpoint = new Field("endpoint", FIELD_TYPE_STRING);
+  auto userAgent = new Field("userAgent", FIELD_TYPE_STRING);
+  auto responseTime = new Field("responseTime", FIELD_TYPE_INT);
+  int64_t ts = 1497000000;
+
+  endpoint->setEncoding(FIELD_ENCODING_DICT);
+  table->setField(timestamp);
+  table->setField(endpoint);
+  table->setField(userAgent);
+  table->setField(responseTime);
+  tables["logs"] = table;
+
+  cout << "generating " << rows << " rows..." << endl;
+
+  for (uint32_t i = 0; i < rows; i++) {
+    if (i % 20 == 0) {
+      ts++;
+    }
+    auto &fields = table->head()->fields;
+    fields["timestamp"]->addValue(GenericValueContainer(ts));
+    fields["endpoint"]->addValue(GenericValueContainer("/api/v1/endpoint" + to_string(rand() % 200)));
+    fields["userAgent"]->addValue(GenericValueContainer("Mozilla/5.0 build " + to_string(rand() % 100000)));
+    fields["responseTime"]->addValue(GenericValueContainer(rand() % 2000));
+    table->incrementRecordCount();
+  }
+
+  table->compact();
+  const auto usedMemory = table->statUsedMemory();
+
+  auto start = chrono::system_clock::now();
+  saveSnapshot(dir, tables);
+  chrono::duration<double> saveElapsed = chrono::system_clock::now() - start;
+
+  map<string, Table *> restored;
+  start = chrono::system_clock::now();
+  loadSnapshot(dir, restored);
+  chrono::duration<double> loadElapsed = chrono::system_clock::now() - start;
+
+  map<string, Table *> mapped;
+  start = chrono::system_clock::now();
+  loadSnapshot(dir, mapped, true);
+  chrono::duration<double> mapElapsed = chrono::system_clock::now() - start;
+
+  cout << "rows: " << restored["logs"]->size << ", used memory: " << usedMemory << " bytes" << endl;
+  cout << "  save:    " << saveElapsed.count() << " sec, " << (uint64_t) megabytesPerSec(usedMemory, saveElapsed) << " MB/sec" << endl;
+  cout << "  restore: " << loadElapsed.count() << " sec, " << (uint64_t) megabytesPerSec(usedMemory, loadElapsed) << " MB/sec" << endl;
+  cout << "  mmap:    " << mapElapsed.count() << " sec, " << mapped["logs"]->statUsedMemory() << " bytes owned" << endl;
+
+  // restored tables must keep their rows through compaction, mapped columns included
+  const string sampleAgent = table->allSegments()[0]->fields["userAgent"]->storage.strval.raw.arr[0];
+  const auto expectedCount = countUserAgent(table, sampleAgent);
+  bool valid = true;
+
+  for (auto &&check : {restored["logs"], mapped["logs"]}) {
+    check->compact();
+    valid = valid && sameUserAgents(table, check) && countUserAgent(check, sampleAgent) == expectedCount;
+  }
+
+  cout << "  compacted restores " << (valid ? "match" : "DO NOT match") << " saved rows" << endl;
+
+  for (auto &&it : tables) {
+    delete it.second;
+  }
+
+  for (auto &&it : restored) {
+    delete it.second;
+  }
+
+  for (auto &&it : mapped) {
+    delete it.second;
+  }
+
+  return valid ? 0 : 1;
+}
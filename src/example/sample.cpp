@@ -9,11 +9,12 @@
 using namespace std;
 
 void insertRow(Table *table, int64_t timestamp, string referrer, string endpoint, string gender, int responseTime) {
-  table->fields["timestamp"]->addValue(GenericValueContainer(timestamp));
-  table->fields["endpoint"]->addValue(GenericValueContainer(endpoint));
-  table->fields["referrer"]->addValue(GenericValueContainer(referrer));
-  table->fields["gender"]->addValue(GenericValueContainer(gender));
-  table->fields["responseTime"]->addValue(GenericValueContainer(responseTime));
+  auto &fields = table->head()->fields;
+  fields["timestamp"]->addValue(GenericValueContainer(timestamp));
+  fields["endpoint"]->addValue(GenericValueContainer(endpoint));
+  fields["referrer"]->addValue(GenericValueContainer(referrer));
+  fields["gender"]->addValue(GenericValueContainer(gender));
+  fields["responseTime"]->addValue(GenericValueContainer(responseTime));
   table->incrementRecordCount();
 }
 
@@ -96,9 +97,6 @@ int main() {
 
   runQuery(table);
 
-  delete fieldTimestamp;
-  delete fieldEndpoint;
-  delete fieldResponseTime;
   delete table;
 
   return 0;
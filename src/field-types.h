@@ -10,9 +10,11 @@ const int FIELD_TYPE_INT = 2;
 const int FIELD_TYPE_STRING = 3;
 const int FIELD_TYPE_BOOLEAN = 4;
 const int FIELD_TYPE_BIGINT = 5; // uint64
+const int FIELD_TYPE_DOUBLE = 6; // query results only, e.g. avg
 
 const int FIELD_ENCODING_NONE = 1;
 const int FIELD_ENCODING_DICT = 2;
 const int FIELD_ENCODING_MULTI_VAL = 3;
+const int FIELD_ENCODING_BSI = 4; // bit-sliced index, int fields only
 
 #endif //MERLIN_FIELD_TYPES_H
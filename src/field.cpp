@@ -1,50 +1,141 @@
 #include <iostream>
-#include "roaring/containers/containers.h"
-#include "roaring/containers/array.h"
+#include <algorithm>
+#include <unordered_map>
 #include "field.h"
+#include "utils.h"
+#include "simd.h"
 
 using namespace std;
 
-struct aggr_func_date_seconds_group_data {
-  int64_t seconds;
-  map<int64_t, roaring_bitmap_t *> &result;
-  Field *field;
-};
+// rows are read from bitmaps in batches of this size in scan kernels
+static const uint32_t SCAN_BATCH_SIZE = 1024;
+// dateSecondsGroup scan uses a dense array of buckets up to this bucket count
+static const uint64_t DENSE_BUCKET_LIMIT = 1 << 16;
+
+static int64_t parseIntFilterValue(const string &fieldName, const string &value) {
+  char *end = nullptr;
+  const int64_t result = strtoll(value.c_str(), &end, 10);
+
+  if (value.empty() || *end != '\0') {
+    throw std::runtime_error("field \"" + fieldName + "\": invalid integer filter value: " + value);
+  }
+
+  return result;
+}
+
+// parses "from,to" value of between operator
+static void parseBetweenFilterValue(const string &fieldName, const string &value, int64_t *from, int64_t *to) {
+  const auto comma = value.find(',');
+
+  if (comma == string::npos) {
+    throw std::runtime_error("field \"" + fieldName + "\": between operator expects \"from,to\" as value");
+  }
+
+  *from = parseIntFilterValue(fieldName, value.substr(0, comma));
+  *to = parseIntFilterValue(fieldName, value.substr(comma + 1));
+}
+
+// start of the dateSecondsGroup bucket timestamp falls into
+static inline int64_t bucketStart(int64_t timestamp, int64_t seconds) {
+  return timeBucketStart(timestamp, seconds);
+}
+
+static uint64_t parseUInt64FilterValue(const string &fieldName, const string &value) {
+  char *end = nullptr;
+  const uint64_t result = strtoull(value.c_str(), &end, 10);
 
-static bool aggrFuncDateSecondsGroup(uint32_t value, void *data);
+  if (value.empty() || value[0] == '-' || *end != '\0') {
+    throw std::runtime_error("field \"" + fieldName + "\": invalid bigint filter value: " + value);
+  }
+
+  return result;
+}
+
+static bool parseBoolFilterValue(const string &fieldName, const string &value) {
+  if (value == "true" || value == "1") {
+    return true;
+  }
+
+  if (value == "false" || value == "0") {
+    return false;
+  }
+
+  throw std::runtime_error("field \"" + fieldName + "\": invalid boolean filter value: " + value);
+}
+
+static inline int64_t nextInt64(int64_t val) {
+  return val == INT64_MAX ? val : val + 1;
+}
+
+template <typename T>
+static inline bool compareInt(const string &op, T val, T from, T to) {
+  if (op == "=") return val == from;
+  if (op == "<") return val < from;
+  if (op == "<=") return val <= from;
+  if (op == ">") return val > from;
+  if (op == ">=") return val >= from;
+  return val >= from && val <= to; // between
+}
 
 void Field::addValue(const GenericValueContainer &genericValueContainer) {
   assert(genericValueContainer.type == type);
 
+  if (frozenBitmaps) {
+    thaw();
+  }
+
   switch (type) {
     case FIELD_TYPE_TIMESTAMP: {
       storage.timestamps.push_back(genericValueContainer.getInt64Val());
+      storage.tsIndex.add(storage.timestamps, genericValueContainer.getInt64Val());
+
+      for (auto &&granularity : storage.timeBuckets) {
+        auto &bucket = granularity.second[bucketStart(genericValueContainer.getInt64Val(), granularity.first)];
+        if (bucket == nullptr) {
+          bucket = roaring_bitmap_create();
+        }
+        roaring_bitmap_add(bucket, (uint32_t) size + 1);
+      }
     } break;
     case FIELD_TYPE_INT: {
-      storage.ivals.push_back(genericValueContainer.getIVal());
+      if (encoding == FIELD_ENCODING_BSI) {
+        storage.bsi->setValue((uint32_t) size + 1, genericValueContainer.getIVal());
+      } else {
+        storage.ivals.push_back(genericValueContainer.getIVal());
+      }
     } break;
     case FIELD_TYPE_STRING: {
-      storage.timestamps.push_back(genericValueContainer.getInt64Val());
-
       switch (encoding) {
         case FIELD_ENCODING_NONE: {
-          storage.strval.raw.arr.push_back(genericValueContainer.getStrVal());
+          storage.strval.raw.arr.push_back(genericValueContainer.strVal);
         } break;
         case FIELD_ENCODING_DICT: {
-          string key = genericValueContainer.getStrVal();
-          uint32_t index = (uint32_t) size + 1;
+          auto &dict = storage.strval.dict.dict;
+          const auto id = dict.getOrInsert(genericValueContainer.strVal);
+          roaring_bitmap_add(dict.bitmaps[id], (uint32_t) size + 1);
 
-          if (storage.strval.dict.dict.count(key)) {
-            roaring_bitmap_add(storage.strval.dict.dict[key], index);
+          if (storage.strval.dict.hasRowIds) {
+            storage.strval.dict.rowIds.push_back(id);
+          }
+        } break;
+        case FIELD_ENCODING_MULTI_VAL: {
+          auto &tags = storage.strval.multi_val.tags;
+
+          if (genericValueContainer.isArray) {
+            for (auto &&tag : genericValueContainer.strArrVal) {
+              roaring_bitmap_add(tags.bitmaps[tags.getOrInsert(tag)], (uint32_t) size + 1);
+            }
           } else {
-            storage.strval.dict.dict[key] = roaring_bitmap_create();
-            roaring_bitmap_add(storage.strval.dict.dict[key], index);
+            roaring_bitmap_add(tags.bitmaps[tags.getOrInsert(genericValueContainer.strVal)], (uint32_t) size + 1);
           }
         } break;
 
         default: throw std::runtime_error("unknown string encoding");
       }
     } break;
+    case FIELD_TYPE_BIGINT: {
+      storage.u64vals.push_back(genericValueContainer.getUInt64Val());
+    } break;
     case FIELD_TYPE_BOOLEAN: {
       if (genericValueContainer.bVal) {
         roaring_bitmap_add(storage.bvals, (uint32_t) size + 1);
@@ -56,8 +147,147 @@ void Field::addValue(const GenericValueContainer &genericValueContainer) {
   size++;
 }
 
-roaring_bitmap_t *Field::getBitmap(string op, string value) {
+void Field::timestampFilterRange(const string &fieldName, const string &op, const string &value, int64_t *from, int64_t *to) {
+  // "between" is inclusive, "range" is half-open.
+  *from = INT64_MIN;
+  *to = INT64_MAX;
+
+  if (op == "between" || op == "range") {
+    parseBetweenFilterValue(fieldName, value, from, to);
+    if (op == "between") {
+      *to = nextInt64(*to);
+    }
+    return;
+  }
+
+  const auto val = parseIntFilterValue(fieldName, value);
+
+  if (op == "=") {
+    *from = val;
+    *to = nextInt64(val);
+  } else if (op == "<") {
+    *to = val;
+  } else if (op == "<=") {
+    *to = nextInt64(val);
+  } else if (op == ">") {
+    *from = nextInt64(val);
+  } else if (op == ">=") {
+    *from = val;
+  } else {
+    throw std::runtime_error("unsupported operator for timestamp field: " + op);
+  }
+}
+
+roaring_bitmap_t *Field::getBitmap(string op, string value, bool &owned) {
+  owned = false;
+
+  // rows not matching "=", booleans and raw strings answer "!=" on their own
+  if (op == "!=" && type != FIELD_TYPE_BOOLEAN && !(type == FIELD_TYPE_STRING && encoding == FIELD_ENCODING_NONE)) {
+    bool equalOwned;
+    const auto equal = getBitmap("=", value, equalOwned);
+    auto result = roaring_bitmap_from_range(1, (uint64_t) size + 1, 1);
+
+    if (equal != nullptr) {
+      roaring_bitmap_andnot_inplace(result, equal);
+      if (equalOwned) {
+        roaring_bitmap_free(equal);
+      }
+    }
+
+    owned = true;
+
+    return result;
+  }
+
   switch (type) {
+    case FIELD_TYPE_TIMESTAMP: {
+      int64_t from;
+      int64_t to;
+      timestampFilterRange(name, op, value, &from, &to);
+
+      owned = true;
+
+      return storage.tsIndex.range(storage.timestamps, from, to);
+    }
+    case FIELD_TYPE_INT: {
+      if (op != "=" && op != "<" && op != "<=" && op != ">" && op != ">=" && op != "between") {
+        throw std::runtime_error("unsupported operator for int field: " + op);
+      }
+
+      int64_t from;
+      int64_t to = 0;
+
+      if (op == "between") {
+        parseBetweenFilterValue(name, value, &from, &to);
+      } else {
+        from = parseIntFilterValue(name, value);
+      }
+
+      owned = true;
+
+      if (encoding == FIELD_ENCODING_BSI) {
+        return op == "between"
+               ? storage.bsi->between(from, to)
+               : storage.bsi->compare(op, from);
+      }
+
+      // no index, scan the column
+      auto result = roaring_bitmap_create();
+
+      for (uint32_t i = 0, len = (uint32_t) storage.ivals.size(); i < len; i++) {
+        if (compareInt<int64_t>(op, storage.ivals[i], from, to)) {
+          roaring_bitmap_add(result, i + 1);
+        }
+      }
+
+      return result;
+    }
+    case FIELD_TYPE_BIGINT: {
+      if (op != "=" && op != "<" && op != "<=" && op != ">" && op != ">=" && op != "between") {
+        throw std::runtime_error("unsupported operator for bigint field: " + op);
+      }
+
+      uint64_t from;
+      uint64_t to = 0;
+
+      if (op == "between") {
+        const auto comma = value.find(',');
+        if (comma == string::npos) {
+          throw std::runtime_error("field \"" + name + "\": between operator expects \"from,to\" as value");
+        }
+        from = parseUInt64FilterValue(name, value.substr(0, comma));
+        to = parseUInt64FilterValue(name, value.substr(comma + 1));
+      } else {
+        from = parseUInt64FilterValue(name, value);
+      }
+
+      owned = true;
+      auto result = roaring_bitmap_create();
+
+      for (uint32_t i = 0, len = (uint32_t) storage.u64vals.size(); i < len; i++) {
+        if (compareInt<uint64_t>(op, storage.u64vals[i], from, to)) {
+          roaring_bitmap_add(result, i + 1);
+        }
+      }
+
+      return result;
+    }
+    case FIELD_TYPE_BOOLEAN: {
+      if (op != "=" && op != "!=") {
+        throw std::runtime_error("unsupported operator for boolean field: " + op);
+      }
+
+      // "= false" and "!= true" are the rows missing from bvals
+      if (parseBoolFilterValue(name, value) == (op == "=")) {
+        return storage.bvals;
+      }
+
+      owned = true;
+      auto result = roaring_bitmap_from_range(1, (uint64_t) size + 1, 1);
+      roaring_bitmap_andnot_inplace(result, storage.bvals);
+
+      return result;
+    }
     case FIELD_TYPE_STRING: {
       switch (encoding) {
         case FIELD_ENCODING_DICT: {
@@ -65,12 +295,21 @@ roaring_bitmap_t *Field::getBitmap(string op, string value) {
             throw std::runtime_error("unsupported operator");
           }
 
-          if (storage.strval.dict.dict.count(value) == 0) {
+          const auto id = storage.strval.dict.dict.find(value);
+
+          if (id == StringDict::NOT_FOUND) {
             return nullptr;
           }
 
-          return storage.strval.dict.dict[value];
+          return storage.strval.dict.dict.bitmaps[id];
         };
+        case FIELD_ENCODING_MULTI_VAL: {
+          return getBitmap(op, vector<string>{value}, owned);
+        }
+        case FIELD_ENCODING_NONE: {
+          owned = true;
+          return storage.strval.raw.arr.match(op, value);
+        }
 
         default: throw std::runtime_error("unsupported string encoding");
       }
@@ -81,6 +320,131 @@ roaring_bitmap_t *Field::getBitmap(string op, string value) {
   return nullptr;
 }
 
+roaring_bitmap_t *Field::getBitmap(string op, const vector<string> &values, bool &owned) {
+  owned = false;
+
+  // rows having any of the values, multi value fields below treat it as contains_any
+  if (op == "in" && !(type == FIELD_TYPE_STRING && encoding == FIELD_ENCODING_MULTI_VAL)) {
+    vector<const roaring_bitmap_t *> bitmaps;
+    vector<roaring_bitmap_t *> temporary;
+
+    try {
+      for (auto &&value : values) {
+        bool valueOwned;
+        const auto bitmap = getBitmap("=", value, valueOwned);
+
+        if (bitmap != nullptr) {
+          bitmaps.push_back(bitmap);
+          if (valueOwned) {
+            temporary.push_back(bitmap);
+          }
+        }
+      }
+    } catch (...) {
+      for (auto &&bitmap : temporary) {
+        roaring_bitmap_free(bitmap);
+      }
+      throw;
+    }
+
+    if (bitmaps.size() == 1) {
+      owned = !temporary.empty();
+      return (roaring_bitmap_t *) bitmaps[0];
+    }
+
+    // a single union over all value bitmaps
+    const auto result = bitmaps.empty() ? nullptr : roaring_bitmap_or_many(bitmaps.size(), bitmaps.data());
+    owned = result != nullptr;
+
+    for (auto &&bitmap : temporary) {
+      roaring_bitmap_free(bitmap);
+    }
+
+    return result;
+  }
+
+  if (op == "in") {
+    op = "contains_any";
+  }
+
+  if (type != FIELD_TYPE_STRING || encoding != FIELD_ENCODING_MULTI_VAL) {
+    if (values.size() != 1) {
+      throw std::runtime_error("field \"" + name + "\": operator " + op + " does not take a list of values");
+    }
+    return getBitmap(op, values[0], owned);
+  }
+
+  const auto &tags = storage.strval.multi_val.tags;
+  vector<const roaring_bitmap_t *> bitmaps;
+
+  if (op != "=" && op != "contains" && op != "contains_any" && op != "contains_all") {
+    throw std::runtime_error("unsupported operator for multi value field: " + op);
+  }
+
+  if ((op == "=" || op == "contains") && values.size() != 1) {
+    throw std::runtime_error("field \"" + name + "\": operator " + op + " expects a single value");
+  }
+
+  for (auto &&value : values) {
+    const auto id = tags.find(value);
+
+    if (id == StringDict::NOT_FOUND) {
+      if (op == "contains_any") {
+        continue;
+      }
+      // a missing tag can't be contained by any row
+      return nullptr;
+    }
+
+    bitmaps.push_back(tags.bitmaps[id]);
+  }
+
+  if (bitmaps.empty()) {
+    return nullptr;
+  }
+
+  if (bitmaps.size() == 1) {
+    return (roaring_bitmap_t *) bitmaps[0];
+  }
+
+  owned = true;
+
+  if (op == "contains_any") {
+    return roaring_bitmap_or_many(bitmaps.size(), bitmaps.data());
+  }
+
+  // contains_all, intersect starting from the smallest bitmap
+  std::sort(bitmaps.begin(), bitmaps.end(), [](const roaring_bitmap_t *a, const roaring_bitmap_t *b) {
+    return roaring_bitmap_get_cardinality(a) < roaring_bitmap_get_cardinality(b);
+  });
+
+  auto result = roaring_bitmap_and(bitmaps[0], bitmaps[1]);
+
+  for (size_t i = 2; i < bitmaps.size() && !roaring_bitmap_is_empty(result); i++) {
+    roaring_bitmap_and_inplace(result, bitmaps[i]);
+  }
+
+  return result;
+}
+
+// one group per dictionary value, rows of multi value fields
+// end up in every group of their tags.
+static void genDictGroups(const StringDict &dict, roaring_bitmap_t *initialBitmap, map<string, roaring_bitmap_t *> &result) {
+  for (uint32_t id = 0, len = dict.size(); id < len; id++) {
+    roaring_bitmap_t *bitmap;
+    if (initialBitmap != nullptr) {
+      bitmap = roaring_bitmap_and(dict.bitmaps[id], initialBitmap);
+    } else {
+      bitmap = roaring_bitmap_copy(dict.bitmaps[id]);
+    }
+    if (roaring_bitmap_is_empty(bitmap)) {
+      roaring_bitmap_free(bitmap);
+      continue;
+    }
+    result[dict.str(id)] = bitmap;
+  }
+}
+
 map<string, roaring_bitmap_t *> Field::genGroups(roaring_bitmap_t *initialBitmap) {
   map<string, roaring_bitmap_t *> result;
 
@@ -93,22 +457,30 @@ map<string, roaring_bitmap_t *> Field::genGroups(roaring_bitmap_t *initialBitmap
       // first get grouping seconds
       // iterate over initial bitmap's results' timestamps
     } break;
+    case FIELD_TYPE_BOOLEAN: {
+      auto trueRows = initialBitmap != nullptr
+                      ? roaring_bitmap_and(storage.bvals, initialBitmap)
+                      : roaring_bitmap_copy(storage.bvals);
+      auto falseRows = initialBitmap != nullptr
+                       ? roaring_bitmap_copy(initialBitmap)
+                       : roaring_bitmap_from_range(1, (uint64_t) size + 1, 1);
+      roaring_bitmap_andnot_inplace(falseRows, storage.bvals);
+
+      for (auto &&group : {make_pair(string("true"), trueRows), make_pair(string("false"), falseRows)}) {
+        if (roaring_bitmap_is_empty(group.second)) {
+          roaring_bitmap_free(group.second);
+        } else {
+          result[group.first] = group.second;
+        }
+      }
+    } break;
     case FIELD_TYPE_STRING: {
       switch (encoding) {
         case FIELD_ENCODING_DICT: {
-          for (auto &&val : storage.strval.dict.dict) {
-            roaring_bitmap_t *bitmap;
-            if (initialBitmap != nullptr) {
-              bitmap = roaring_bitmap_and(val.second, initialBitmap);
-            } else {
-              bitmap = roaring_bitmap_copy(val.second);
-            }
-            if (roaring_bitmap_get_cardinality(bitmap) == 0) {
-              roaring_bitmap_free(bitmap);
-              continue;
-            }
-            result[val.first] = bitmap;
-          }
+          genDictGroups(storage.strval.dict.dict, initialBitmap, result);
+        } break;
+        case FIELD_ENCODING_MULTI_VAL: {
+          genDictGroups(storage.strval.multi_val.tags, initialBitmap, result);
         } break;
         default: throw std::runtime_error("field \"" + name + "\": unsupported string encoding " + to_string(encoding) + " for group by.");
       }
@@ -119,22 +491,242 @@ map<string, roaring_bitmap_t *> Field::genGroups(roaring_bitmap_t *initialBitmap
   return std::move(result);
 };
 
-static bool aggrFuncDateSecondsGroup(uint32_t value, void *data) {
-  const auto *ctx = (aggr_func_date_seconds_group_data *) data;
-  const auto timestamp = ctx->field->storage.timestamps[value - 1];
-  //  const int64_t group = timestamp - (int64_t) fastrange64((uint64_t) timestamp, (uint64_t) ctx->seconds);
-  const int64_t group = timestamp - (timestamp % ctx->seconds);
-  roaring_bitmap_t *roar = nullptr;
+void Field::genDateSecondsGroupsScan(roaring_bitmap_t *initialBitmap, int64_t seconds, map<int64_t, roaring_bitmap_t *> &result) {
+  roaring_bitmap_t *allRows = nullptr;
+
+  if (size == 0) {
+    return;
+  }
+
+  if (initialBitmap == nullptr) {
+    allRows = roaring_bitmap_from_range(1, (uint64_t) size + 1, 1);
+    initialBitmap = allRows;
+  }
+
+  // buckets are kept in a dense array when whole column spans few of them
+  const int64_t firstBucket = bucketStart(storage.tsIndex.minValue(), seconds);
+  const int64_t lastBucket = bucketStart(storage.tsIndex.maxValue(), seconds);
+  const uint64_t bucketCount = ((uint64_t) lastBucket - (uint64_t) firstBucket) / seconds + 1;
+  const bool dense = bucketCount <= DENSE_BUCKET_LIMIT;
+  vector<roaring_bitmap_t *> denseBuckets;
+  unordered_map<int64_t, roaring_bitmap_t *> sparseBuckets;
+
+  if (dense) {
+    denseBuckets.assign(bucketCount, nullptr);
+  }
+
+  uint32_t rows[SCAN_BATCH_SIZE];
+  int64_t values[SCAN_BATCH_SIZE];
+  roaring_uint32_iterator_t *it = roaring_create_iterator(initialBitmap);
+
+  for (;;) {
+    const uint32_t count = roaring_read_uint32_iterator(it, rows, SCAN_BATCH_SIZE);
+
+    if (count == 0) {
+      break;
+    }
+
+    storage.timestamps.gather(rows, count, values);
+
+    // row ids are increasing and timestamps are mostly ordered,
+    // so consecutive rows tend to fall into the same bucket.
+    // find each run and append it to its bucket at once.
+    uint32_t i = 0;
+
+    while (i < count) {
+      const int64_t group = bucketStart(values[i], seconds);
+      const auto runLength = 1 + (uint32_t) simdRangePrefixLength(values + i + 1, count - i - 1, group, group + seconds);
+      auto &bucket = dense
+                     ? denseBuckets[((uint64_t) group - (uint64_t) firstBucket) / seconds]
+                     : sparseBuckets[group];
 
-  if (ctx->result.count(group) == 1) {
-    roar = ctx->result[group];
+      if (bucket == nullptr) {
+        bucket = roaring_bitmap_create();
+      }
+
+      roaring_bitmap_add_many(bucket, runLength, rows + i);
+      i += runLength;
+    }
+  }
+
+  roaring_free_uint32_iterator(it);
+
+  if (allRows != nullptr) {
+    roaring_bitmap_free(allRows);
+  }
+
+  if (dense) {
+    for (uint64_t i = 0; i < bucketCount; i++) {
+      if (denseBuckets[i] != nullptr) {
+        result.emplace_hint(result.end(), firstBucket + (int64_t) i * seconds, denseBuckets[i]);
+      }
+    }
   } else {
-    roar = roaring_bitmap_create();
-    ctx->result[group] = roar;
+    for (auto &&bucket : sparseBuckets) {
+      result[bucket.first] = bucket.second;
+    }
+  }
+}
+
+Field *Field::cloneDefinition() const {
+  auto field = new Field(name, type);
+  field->setEncoding(encoding);
+
+  if (storage.strval.dict.hasRowIds) {
+    field->enableRowIds();
+  }
+
+  for (auto &&granularity : storage.timeBuckets) {
+    field->addTimeBucketGranularity(granularity.first);
+  }
+
+  return field;
+}
+
+Field::Field(const Field &other): name(other.name), type(other.type), encoding(other.encoding), size(other.size),
+                                  storage(other.storage), mapping(other.mapping), frozenBitmaps(false) {
+  for (auto &&granularity : storage.timeBuckets) {
+    for (auto &&bucket : granularity.second) {
+      bucket.second = roaring_bitmap_copy(bucket.second);
+    }
+  }
+
+  if (storage.bsi != nullptr) {
+    storage.bsi = new BitSlicedIndex(*storage.bsi);
   }
 
-  roaring_bitmap_add(roar, value);
-  return true;
+  if (storage.bvals != nullptr) {
+    storage.bvals = roaring_bitmap_copy(storage.bvals);
+  }
+}
+
+Field *Field::clone() const {
+  return new Field(*this);
+}
+
+void Field::enableRowIds() {
+  if (type != FIELD_TYPE_STRING || encoding != FIELD_ENCODING_DICT) {
+    throw std::runtime_error("field \"" + name + "\": row ids are only supported for dict encoded string fields");
+  }
+
+  auto &dictStorage = storage.strval.dict;
+
+  if (dictStorage.hasRowIds) {
+    return;
+  }
+
+  vector<uint32_t> ids((size_t) size, 0);
+
+  for (uint32_t id = 0, len = dictStorage.dict.size(); id < len; id++) {
+    roaring_uint32_iterator_t *it = roaring_create_iterator(dictStorage.dict.bitmaps[id]);
+    while (it->has_value) {
+      ids[it->current_value - 1] = id;
+      roaring_advance_uint32_iterator(it);
+    }
+    roaring_free_uint32_iterator(it);
+  }
+
+  for (auto &&id : ids) {
+    dictStorage.rowIds.push_back(id);
+  }
+
+  dictStorage.hasRowIds = true;
+}
+
+uint64_t Field::estimateDistinctCount(const vector<string> &funcArgs) {
+  switch (type) {
+    case FIELD_TYPE_STRING: {
+      if (encoding == FIELD_ENCODING_DICT) {
+        return storage.strval.dict.dict.size();
+      }
+    } break;
+    case FIELD_TYPE_TIMESTAMP: {
+      const int64_t secs = funcArgs.empty() ? 0 : strtoll(funcArgs[0].c_str(), nullptr, 10);
+      if (secs > 0 && size > 0) {
+        const int64_t firstBucket = bucketStart(storage.tsIndex.minValue(), secs);
+        const int64_t lastBucket = bucketStart(storage.tsIndex.maxValue(), secs);
+        return ((uint64_t) lastBucket - (uint64_t) firstBucket) / secs + 1;
+      }
+    } break;
+    default: break;
+  }
+
+  return (uint64_t) size;
+}
+
+void Field::addTimeBucketGranularity(int64_t seconds) {
+  if (type != FIELD_TYPE_TIMESTAMP) {
+    throw std::runtime_error("field \"" + name + "\": time buckets are only supported for timestamp fields");
+  }
+
+  if (seconds <= 0) {
+    throw std::runtime_error("field \"" + name + "\": invalid time bucket granularity " + to_string(seconds));
+  }
+
+  if (storage.timeBuckets.count(seconds) == 1) {
+    return;
+  }
+
+  auto &buckets = storage.timeBuckets[seconds];
+
+  for (uint32_t i = 0, len = (uint32_t) storage.timestamps.size(); i < len; i++) {
+    auto &bucket = buckets[bucketStart(storage.timestamps[i], seconds)];
+    if (bucket == nullptr) {
+      bucket = roaring_bitmap_create();
+    }
+    roaring_bitmap_add(bucket, i + 1);
+  }
+}
+
+void Field::genTimeBucketGroups(roaring_bitmap_t *initialBitmap, int64_t granularity, int64_t seconds, map<int64_t, roaring_bitmap_t *> &result) {
+  const auto &buckets = storage.timeBuckets[granularity];
+  const bool hasFilter = initialBitmap != nullptr;
+  const uint32_t minRow = hasFilter ? roaring_bitmap_minimum(initialBitmap) : 0;
+  const uint32_t maxRow = hasFilter ? roaring_bitmap_maximum(initialBitmap) : UINT32_MAX;
+
+  if (hasFilter && roaring_bitmap_is_empty(initialBitmap)) {
+    return;
+  }
+
+  // buckets are ordered by their start, so buckets of the same
+  // wider group are adjacent.
+  vector<const roaring_bitmap_t *> parts;
+  auto it = buckets.begin();
+
+  while (it != buckets.end()) {
+    const int64_t group = bucketStart(it->first, seconds);
+    parts.clear();
+
+    for (; it != buckets.end() && bucketStart(it->first, seconds) == group; ++it) {
+      // skip buckets whose rows can't overlap with the filter
+      if (hasFilter && (roaring_bitmap_maximum(it->second) < minRow || roaring_bitmap_minimum(it->second) > maxRow)) {
+        continue;
+      }
+      parts.push_back(it->second);
+    }
+
+    if (parts.empty()) {
+      continue;
+    }
+
+    roaring_bitmap_t *bitmap;
+
+    if (parts.size() == 1) {
+      bitmap = hasFilter ? roaring_bitmap_and(parts[0], initialBitmap) : roaring_bitmap_copy(parts[0]);
+    } else {
+      bitmap = roaring_bitmap_or_many(parts.size(), parts.data());
+      if (hasFilter) {
+        roaring_bitmap_and_inplace(bitmap, initialBitmap);
+      }
+    }
+
+    if (roaring_bitmap_is_empty(bitmap)) {
+      roaring_bitmap_free(bitmap);
+      continue;
+    }
+
+    result[group] = bitmap;
+  }
 }
 
 map<string, roaring_bitmap_t *> Field::genGroups(roaring_bitmap_t *initialBitmap, string func, vector<string> funcArgs) {
@@ -149,130 +741,488 @@ map<string, roaring_bitmap_t *> Field::genGroups(roaring_bitmap_t *initialBitmap
     throw std::runtime_error("only dateSecondsGroup function is supported at the moment");
   }
 
+  if (funcArgs.size() != 1) {
+    throw std::runtime_error("dateSecondsGroup expects bucket width in seconds as its only argument");
+  }
+
   const auto cStr = funcArgs[0].c_str();
   const int64_t secs = strtoll(cStr, nullptr, 10);
-  aggr_func_date_seconds_group_data aggrResult = {
-    .seconds = secs,
-    .result = intResult,
-    .field = this
-  };
 
-  roaring_iterate(initialBitmap, aggrFuncDateSecondsGroup, (void *) &aggrResult);
+  if (secs <= 0) {
+    throw std::runtime_error("dateSecondsGroup: invalid bucket width: " + funcArgs[0]);
+  }
+
+  // prefer precomputed buckets. a coarser width can be built by merging
+  // the buckets of any precomputed granularity dividing it.
+  int64_t granularity = 0;
 
-  for (auto &&timeStamp : aggrResult.result) {
+  for (auto &&it : storage.timeBuckets) {
+    if (secs % it.first == 0) {
+      granularity = it.first;
+    }
+  }
+
+  if (granularity != 0) {
+    genTimeBucketGroups(initialBitmap, granularity, secs, intResult);
+  } else {
+    genDateSecondsGroupsScan(initialBitmap, secs, intResult);
+  }
+
+  for (auto &&timeStamp : intResult) {
     result[to_string(timeStamp.first)] = timeStamp.second;
   }
 
   return std::move(result);
 }
 
-uint64_t Field::aggrFuncMin(roaring_bitmap_t *bitmap) {
-  int min = INT_MAX;
+int64_t Field::statUsedMemory() {
+  int64_t sum = sizeof(Field) + name.capacity();
 
-  if (type != FIELD_TYPE_INT) {
-    throw std::runtime_error("only int fields supported by min()");
+  switch (type) {
+    case FIELD_TYPE_TIMESTAMP: {
+      sum += storage.timestamps.statUsedMemory() + storage.tsIndex.statUsedMemory();
+      for (auto &&granularity : storage.timeBuckets) {
+        sum += MAP_NODE_OVERHEAD + sizeof(granularity);
+        for (auto &&bucket : granularity.second) {
+          sum += MAP_NODE_OVERHEAD + sizeof(bucket) + ownedBitmapMemory(bucket.second);
+        }
+      }
+    } break;
+    case FIELD_TYPE_INT: {
+      if (encoding == FIELD_ENCODING_BSI) {
+        sum += sizeof(BitSlicedIndex) + sizeof(roaring_bitmap_t *) * storage.bsi->slices.capacity();
+        sum += ownedBitmapMemory(storage.bsi->ebm);
+        for (auto &&slice : storage.bsi->slices) {
+          sum += ownedBitmapMemory(slice);
+        }
+      } else {
+        sum += storage.ivals.statUsedMemory();
+      }
+    } break;
+    case FIELD_TYPE_BIGINT: {
+      sum += sizeof(uint64_t) * storage.u64vals.capacity();
+    } break;
+    case FIELD_TYPE_BOOLEAN: {
+      sum += ownedBitmapMemory(storage.bvals);
+    } break;
+    case FIELD_TYPE_STRING: {
+      switch (encoding) {
+        case FIELD_ENCODING_DICT: {
+          sum += storage.strval.dict.dict.statUsedMemory() + storage.strval.dict.rowIds.statUsedMemory();
+          for (auto &&bitmap : storage.strval.dict.dict.bitmaps) {
+            sum += ownedBitmapMemory(bitmap);
+          }
+        } break;
+        case FIELD_ENCODING_NONE: {
+          sum += storage.strval.raw.arr.statUsedMemory();
+        } break;
+        case FIELD_ENCODING_MULTI_VAL: {
+          sum += storage.strval.multi_val.tags.statUsedMemory();
+          for (auto &&bitmap : storage.strval.multi_val.tags.bitmaps) {
+            sum += ownedBitmapMemory(bitmap);
+          }
+        } break;
+        default:
+          throw std::runtime_error("statUsedMemory not implemented for string field encoding " + to_string(encoding));
+      }
+    } break;
+    default:
+      throw std::runtime_error("statUsedMemory not implemented for field type " + to_string(type));
   }
 
-  roaring_uint32_iterator_t *i = roaring_create_iterator(bitmap);
+  return sum;
+}
 
-  while(i->has_value) {
-    auto curr = storage.ivals[i->current_value - 1];
-    min = std::min(min, curr);
-    roaring_advance_uint32_iterator(i);
-  }
+int64_t Field::compact() {
+  const int64_t before = statUsedMemory();
+  // mapped bitmaps are read only views
+  auto compactBitmap = [this](roaring_bitmap_t *bitmap) {
+    if (!frozenBitmaps) {
+      roaring_bitmap_run_optimize(bitmap);
+      roaring_bitmap_shrink_to_fit(bitmap);
+    }
+  };
 
-  roaring_free_uint32_iterator(i);
+  switch (type) {
+    case FIELD_TYPE_TIMESTAMP: {
+      storage.timestamps.shrinkToFit();
+      storage.tsIndex.shrinkToFit();
+      for (auto &&granularity : storage.timeBuckets) {
+        for (auto &&bucket : granularity.second) {
+          compactBitmap(bucket.second);
+        }
+      }
+    } break;
+    case FIELD_TYPE_INT: {
+      if (encoding == FIELD_ENCODING_BSI) {
+        compactBitmap(storage.bsi->ebm);
+        for (auto &&slice : storage.bsi->slices) {
+          compactBitmap(slice);
+        }
+      } else {
+        storage.ivals.shrinkToFit();
+      }
+    } break;
+    case FIELD_TYPE_BIGINT: {
+      storage.u64vals.shrink_to_fit();
+    } break;
+    case FIELD_TYPE_BOOLEAN: {
+      compactBitmap(storage.bvals);
+    } break;
+    case FIELD_TYPE_STRING: {
+      switch (encoding) {
+        case FIELD_ENCODING_NONE: {
+          storage.strval.raw.arr.shrinkToFit();
+        } break;
+        case FIELD_ENCODING_DICT: {
+          storage.strval.dict.dict.shrinkToFit();
+          storage.strval.dict.rowIds.shrinkToFit();
+          for (auto &&bitmap : storage.strval.dict.dict.bitmaps) {
+            compactBitmap(bitmap);
+          }
+        } break;
+        case FIELD_ENCODING_MULTI_VAL: {
+          storage.strval.multi_val.tags.shrinkToFit();
+          for (auto &&bitmap : storage.strval.multi_val.tags.bitmaps) {
+            compactBitmap(bitmap);
+          }
+        } break;
+        default: throw std::runtime_error("unknown string encoding");
+      }
+    } break;
+    default: throw std::runtime_error("unknown field type");
+  }
 
-  return (uint64_t) min;
+  return before - statUsedMemory();
 }
 
-uint64_t Field::aggrFuncMax(roaring_bitmap_t *bitmap) {
-  int max = INT_MIN;
+// "MFLD" followed by format version
+static const uint32_t FIELD_SNAPSHOT_MAGIC = 0x444c464d;
+static const uint32_t FIELD_SNAPSHOT_VERSION = 2;
 
-  if (type != FIELD_TYPE_INT) {
-    throw std::runtime_error("only int fields supported by max()");
-  }
-
-  roaring_uint32_iterator_t *i = roaring_create_iterator(bitmap);
+void Field::save(SnapshotWriter &writer) {
+  writer.writeValue(FIELD_SNAPSHOT_MAGIC);
+  writer.writeValue(FIELD_SNAPSHOT_VERSION);
+  writer.writeString(name);
+  writer.writeValue(type);
+  writer.writeValue(encoding);
+  writer.writeValue(size);
 
-  while(i->has_value) {
-    auto curr = storage.ivals[i->current_value - 1];
-    max = std::max(max, curr);
-    roaring_advance_uint32_iterator(i);
+  switch (type) {
+    case FIELD_TYPE_TIMESTAMP: {
+      storage.timestamps.save(writer);
+      storage.tsIndex.save(writer);
+      writer.writeValue((uint64_t) storage.timeBuckets.size());
+      for (auto &&granularity : storage.timeBuckets) {
+        writer.writeValue(granularity.first);
+        writer.writeValue((uint64_t) granularity.second.size());
+        for (auto &&bucket : granularity.second) {
+          writer.writeValue(bucket.first);
+          writer.writeBitmap(bucket.second);
+        }
+      }
+    } break;
+    case FIELD_TYPE_INT: {
+      if (encoding == FIELD_ENCODING_BSI) {
+        storage.bsi->save(writer);
+      } else {
+        storage.ivals.save(writer);
+      }
+    } break;
+    case FIELD_TYPE_BIGINT: {
+      writer.writeVector(storage.u64vals);
+    } break;
+    case FIELD_TYPE_BOOLEAN: {
+      writer.writeBitmap(storage.bvals);
+    } break;
+    case FIELD_TYPE_STRING: {
+      switch (encoding) {
+        case FIELD_ENCODING_NONE: {
+          storage.strval.raw.arr.save(writer);
+        } break;
+        case FIELD_ENCODING_DICT: {
+          storage.strval.dict.dict.save(writer);
+          writer.writeValue((uint8_t) storage.strval.dict.hasRowIds);
+          if (storage.strval.dict.hasRowIds) {
+            storage.strval.dict.rowIds.save(writer);
+          }
+        } break;
+        case FIELD_ENCODING_MULTI_VAL: {
+          storage.strval.multi_val.tags.save(writer);
+        } break;
+        default: throw std::runtime_error("unknown string encoding");
+      }
+    } break;
+    default: throw std::runtime_error("unknown field type");
   }
+}
 
-  roaring_free_uint32_iterator(i);
+Field *Field::load(SnapshotReader &reader) {
+  if (reader.readValue<uint32_t>() != FIELD_SNAPSHOT_MAGIC) {
+    throw std::runtime_error("not a field snapshot");
+  }
 
-  return (uint64_t) max;
-}
+  if (reader.readValue<uint32_t>() != FIELD_SNAPSHOT_VERSION) {
+    throw std::runtime_error("unsupported field snapshot version");
+  }
 
-uint64_t Field::aggrFuncSum(roaring_bitmap_t *bitmap) {
-  uint64_t sum = 0;
+  const auto name = reader.readString();
+  const auto type = reader.readValue<int>();
+  auto field = new Field(name, type);
 
-  if (type != FIELD_TYPE_INT) {
-    throw std::runtime_error("only int fields supported by sum()");
+  if (reader.isZeroCopy()) {
+    field->mapping = reader.mapping();
+    field->frozenBitmaps = true;
   }
 
-  roaring_uint32_iterator_t *i = roaring_create_iterator(bitmap);
+  try {
+    field->setEncoding(reader.readValue<int>());
+    field->size = reader.readValue<int>();
+
+    auto &storage = field->storage;
 
-  while(i->has_value) {
-    sum += storage.ivals[i->current_value - 1];
-    roaring_advance_uint32_iterator(i);
+    switch (type) {
+      case FIELD_TYPE_TIMESTAMP: {
+        storage.timestamps.load(reader);
+        storage.tsIndex.load(reader);
+        for (auto granularityCount = reader.readValue<uint64_t>(); granularityCount > 0; granularityCount--) {
+          auto &buckets = storage.timeBuckets[reader.readValue<int64_t>()];
+          for (auto bucketCount = reader.readValue<uint64_t>(); bucketCount > 0; bucketCount--) {
+            const auto start = reader.readValue<int64_t>();
+            const auto bitmap = reader.readBitmap();
+            buckets[start] = bitmap;
+          }
+        }
+      } break;
+      case FIELD_TYPE_INT: {
+        if (field->encoding == FIELD_ENCODING_BSI) {
+          storage.bsi->load(reader);
+        } else {
+          storage.ivals.load(reader);
+        }
+      } break;
+      case FIELD_TYPE_BIGINT: {
+        reader.readVector(storage.u64vals);
+      } break;
+      case FIELD_TYPE_BOOLEAN: {
+        const auto bvals = reader.readBitmap();
+        roaring_bitmap_free(storage.bvals);
+        storage.bvals = bvals;
+      } break;
+      case FIELD_TYPE_STRING: {
+        switch (field->encoding) {
+          case FIELD_ENCODING_NONE: {
+            storage.strval.raw.arr.load(reader);
+          } break;
+          case FIELD_ENCODING_DICT: {
+            storage.strval.dict.dict.load(reader);
+            storage.strval.dict.hasRowIds = reader.readValue<uint8_t>() != 0;
+            if (storage.strval.dict.hasRowIds) {
+              storage.strval.dict.rowIds.load(reader);
+            }
+          } break;
+          case FIELD_ENCODING_MULTI_VAL: {
+            storage.strval.multi_val.tags.load(reader);
+          } break;
+          default: throw std::runtime_error("unknown string encoding");
+        }
+      } break;
+      default: throw std::runtime_error("unknown field type");
+    }
+  } catch (...) {
+    delete field;
+    throw;
   }
 
-  roaring_free_uint32_iterator(i);
+  return field;
+}
 
-  return sum;
+// replaces a frozen view with an owned copy
+static void thawBitmap(roaring_bitmap_t *&bitmap) {
+  auto copy = roaring_bitmap_copy(bitmap);
+  roaring_bitmap_free(bitmap);
+  bitmap = copy;
 }
 
-int64_t Field::statUsedMemory() {
+void Field::thaw() {
   switch (type) {
     case FIELD_TYPE_TIMESTAMP: {
-      return sizeof(int64_t) * storage.timestamps.capacity();
-    }
+      for (auto &&granularity : storage.timeBuckets) {
+        for (auto &&bucket : granularity.second) {
+          thawBitmap(bucket.second);
+        }
+      }
+    } break;
     case FIELD_TYPE_INT: {
-      return sizeof(int) * storage.ivals.capacity();
+      if (encoding == FIELD_ENCODING_BSI) {
+        thawBitmap(storage.bsi->ebm);
+        for (auto &&slice : storage.bsi->slices) {
+          thawBitmap(slice);
+        }
+      }
+    } break;
+    case FIELD_TYPE_BOOLEAN: {
+      thawBitmap(storage.bvals);
+    } break;
+    case FIELD_TYPE_STRING: {
+      if (encoding == FIELD_ENCODING_DICT) {
+        for (auto &&bitmap : storage.strval.dict.dict.bitmaps) {
+          thawBitmap(bitmap);
+        }
+      } else if (encoding == FIELD_ENCODING_MULTI_VAL) {
+        for (auto &&bitmap : storage.strval.multi_val.tags.bitmaps) {
+          thawBitmap(bitmap);
+        }
+      }
+    } break;
+    default: break;
+  }
+
+  // sealed column blocks keep pointing into the mapping, so it is kept
+  frozenBitmaps = false;
+}
+
+// ids of dictionary values some of given rows have.
+// few rows are looked up by their ids, many rows are intersected with value bitmaps.
+static void dictIdsOfRows(const StringDict &dict, const DictIdColumn *rowIds, roaring_bitmap_t *bitmap, vector<uint32_t> &ids) {
+  const auto rows = roaring_bitmap_get_cardinality(bitmap);
+
+  if (rowIds != nullptr && rows < dict.size()) {
+    vector<bool> seen(dict.size(), false);
+    uint32_t batch[SCAN_BATCH_SIZE];
+    roaring_uint32_iterator_t *it = roaring_create_iterator(bitmap);
+
+    for (uint32_t count; (count = roaring_read_uint32_iterator(it, batch, SCAN_BATCH_SIZE)) > 0; ) {
+      for (uint32_t j = 0; j < count; j++) {
+        const auto id = (*rowIds)[batch[j] - 1];
+        if (!seen[id]) {
+          seen[id] = true;
+          ids.push_back(id);
+        }
+      }
+    }
+
+    roaring_free_uint32_iterator(it);
+    return;
+  }
+
+  for (uint32_t id = 0; id < dict.size(); id++) {
+    if (roaring_bitmap_intersect(dict.bitmaps[id], bitmap)) {
+      ids.push_back(id);
     }
+  }
+}
+
+// calls fn with every value of given rows of a string or boolean field,
+// dictionary values once no matter how many rows have them
+template <typename Fn>
+static void forEachStringValue(Field *field, roaring_bitmap_t *bitmap, Fn fn) {
+  vector<uint32_t> ids;
+
+  switch (field->type) {
+    case FIELD_TYPE_BOOLEAN: {
+      const auto trueRows = roaring_bitmap_and_cardinality(bitmap, field->storage.bvals);
+      if (trueRows > 0) {
+        fn(string("true"));
+      }
+      if (trueRows < roaring_bitmap_get_cardinality(bitmap)) {
+        fn(string("false"));
+      }
+    } break;
     case FIELD_TYPE_STRING: {
-      switch (encoding) {
+      switch (field->encoding) {
         case FIELD_ENCODING_DICT: {
-          int sum = 0;
-          for (auto &&it : storage.strval.dict.dict) {
-            sum += it.first.size();
-            // I don't know how much bytes taken by each record
-            // so I am just adding 10
-            sum += 10;
-            // roaring bitmap does not give used memory.
-            // I will try to calculate it by hand
-            auto r = it.second;
-            for (int i = 0; i < r->high_low_container.size; i++) {
-              uint8_t typecode;
-              void *cont = ra_get_container_at_index(&r->high_low_container, i, &typecode);
-              switch (typecode) {
-                case BITSET_CONTAINER_TYPE_CODE: {
-                  sum += sizeof(bitset_container_t);
-                  sum += sizeof(uint64_t) * BITSET_CONTAINER_SIZE_IN_WORDS;
-                } break;
-                case ARRAY_CONTAINER_TYPE_CODE: {
-                  sum += sizeof(array_container_t);
-                  sum += sizeof(uint16_t) * ((array_container_t *)cont)->capacity;
-                } break;
-                case RUN_CONTAINER_TYPE_CODE: {
-                  sum += sizeof(run_container_t);
-                  sum += sizeof(rle16_t) * ((run_container_t *)cont)->capacity;
-                } break;
-                default:
-                  cout << "Field::statUsedMemory(): skipping unknown container type: " << typecode << endl;
-              }
-            }
+          const auto &dict = field->storage.strval.dict;
+          dictIdsOfRows(dict.dict, dict.hasRowIds ? &dict.rowIds : nullptr, bitmap, ids);
+          for (auto &&id : ids) {
+            fn(dict.dict.str(id));
           }
-          return sum;
-        }
-        default:
-          throw std::runtime_error("statUsedMemory not implemented for string field encoding " + to_string(encoding));
+        } break;
+        case FIELD_ENCODING_MULTI_VAL: {
+          const auto &tags = field->storage.strval.multi_val.tags;
+          dictIdsOfRows(tags, nullptr, bitmap, ids);
+          for (auto &&id : ids) {
+            fn(tags.str(id));
+          }
+        } break;
+        default: {
+          roaring_uint32_iterator_t *it = roaring_create_iterator(bitmap);
+          while (it->has_value) {
+            fn(field->storage.strval.raw.arr[it->current_value - 1]);
+            roaring_advance_uint32_iterator(it);
+          }
+          roaring_free_uint32_iterator(it);
+        } break;
       }
+    } break;
+    default: throw std::runtime_error("field \"" + field->name + "\": not a string or boolean field");
+  }
+}
+
+// calls fn with the value of every given row of a timestamp, int or bigint field
+template <typename Fn>
+static void forEachIntValue(Field *field, roaring_bitmap_t *bitmap, Fn fn) {
+  field->scanInts(bitmap, [&](const int64_t *values, uint32_t count) {
+    for (uint32_t j = 0; j < count; j++) {
+      fn((uint64_t) values[j]);
     }
-    default:
-      throw std::runtime_error("statUsedMemory not implemented for field type " + to_string(type));
+  });
+}
+
+void Field::scanInts(roaring_bitmap_t *bitmap, const function<void(const int64_t *values, uint32_t count)> &fn) {
+  uint32_t rows[SCAN_BATCH_SIZE];
+  int64_t values[SCAN_BATCH_SIZE];
+
+  if (type != FIELD_TYPE_TIMESTAMP && type != FIELD_TYPE_INT && type != FIELD_TYPE_BIGINT) {
+    throw std::runtime_error("field \"" + name + "\": not a timestamp, int or bigint field");
+  }
+
+  roaring_uint32_iterator_t *it = roaring_create_iterator(bitmap);
+
+  for (uint32_t count; (count = roaring_read_uint32_iterator(it, rows, SCAN_BATCH_SIZE)) > 0; ) {
+    gatherInts(rows, count, values);
+    fn(values, count);
   }
-}
\ No newline at end of file
+
+  roaring_free_uint32_iterator(it);
+}
+
+void Field::gatherInts(const uint32_t *rows, uint32_t count, int64_t *values) {
+  if (type == FIELD_TYPE_TIMESTAMP) {
+    storage.timestamps.gather(rows, count, values);
+  } else if (type == FIELD_TYPE_BIGINT) {
+    for (uint32_t j = 0; j < count; j++) {
+      values[j] = (int64_t) storage.u64vals[rows[j] - 1];
+    }
+  } else if (encoding == FIELD_ENCODING_BSI) {
+    for (uint32_t j = 0; j < count; j++) {
+      values[j] = storage.bsi->getValue(rows[j]);
+    }
+  } else {
+    storage.ivals.gather(rows, count, values);
+  }
+}
+
+void Field::distinctStrings(roaring_bitmap_t *bitmap, unordered_set<string> &values) {
+  forEachStringValue(this, bitmap, [&](const string &value) {
+    values.insert(value);
+  });
+}
+
+void Field::distinctInts(roaring_bitmap_t *bitmap, unordered_set<uint64_t> &values) {
+  forEachIntValue(this, bitmap, [&](uint64_t value) {
+    values.insert(value);
+  });
+}
+
+void Field::addToSketch(roaring_bitmap_t *bitmap, HyperLogLog &sketch) {
+  if (hasStringValues()) {
+    forEachStringValue(this, bitmap, [&](const string &value) {
+      sketch.add(hashValue(value));
+    });
+  } else {
+    forEachIntValue(this, bitmap, [&](uint64_t value) {
+      sketch.add(hashValue(value));
+    });
+  }
+}
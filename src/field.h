@@ -5,11 +5,21 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_set>
+#include <functional>
 #include <stdlib.h>
 #include "roaring/roaring.h"
 #include "../deps/fastrange/fastrange.h"
 #include "field-types.h"
 #include "generic-value.h"
+#include "bsi.h"
+#include "timestamp-index.h"
+#include "string-dict.h"
+#include "packed-column.h"
+#include "string-column.h"
+#include "hyperloglog.h"
+#include "snapshot.h"
+#include "utils.h"
 
 #ifndef MERLIN_FIELD_H
 #define MERLIN_FIELD_H
@@ -27,51 +37,70 @@ class Field {
 
   struct {
     // FIELD_TYPE_TIMESTAMP
-    vector<int64_t> timestamps;
+    PackedColumn timestamps;
+    TimestampIndex tsIndex;
+    // precomputed dateSecondsGroup buckets.
+    // granularity in seconds > bucket start > rows in bucket
+    map<int64_t, map<int64_t, roaring_bitmap_t *>> timeBuckets;
     // FIELD_TYPE_INT
-    vector<int> ivals;
-    // FIELD_TYPE_BOOLEAN
+    PackedColumn ivals;
+    // FIELD_TYPE_INT + FIELD_ENCODING_BSI
+    BitSlicedIndex *bsi;
+    // FIELD_TYPE_BIGINT
+    vector<uint64_t> u64vals;
+    // FIELD_TYPE_BOOLEAN, rows having true
     roaring_bitmap_t *bvals;
     // FIELD_TYPE_STRING
     struct {
       struct {
         // FIELD_ENCODING_NONE
-        vector<string> arr;
+        StringColumn arr;
       } raw;
       struct {
         // FIELD_ENCODING_DICT
-        map<string, roaring_bitmap_t *> dict;
+        StringDict dict;
+        // optional per row dictionary ids, used by scan based group by
+        bool hasRowIds;
+        DictIdColumn rowIds;
       } dict;
       struct {
-        // FIELD_ENCODING_MULTI_VAL
-        vector<vector<int>> valArrays;
-        map<string, int> idMap;
-        map<int, roaring_bitmap_t *> idToBitmap;
+        // FIELD_ENCODING_MULTI_VAL, rows having each tag
+        StringDict tags;
       } multi_val;
     } strval;
 
   } storage;
 
+  // snapshot file the field was loaded from without copying.
+  // while frozenBitmaps is set, bitmaps are read only views into it
+  // and the first write copies them into memory.
+  shared_ptr<MappedFile> mapping;
+  bool frozenBitmaps;
+
   Field(string name_, int type_): name(name_), type(type_) {
     encoding = FIELD_ENCODING_NONE;
     size = 0;
+    storage.bsi = nullptr;
+    storage.bvals = type == FIELD_TYPE_BOOLEAN ? roaring_bitmap_create() : nullptr;
+    storage.strval.dict.hasRowIds = false;
+    frozenBitmaps = false;
   }
 
   ~Field() {
     switch (type) {
-      case FIELD_TYPE_BOOLEAN: {
-        roaring_bitmap_free(storage.bvals);
-      } break;
-      case FIELD_TYPE_STRING: {
-        switch (encoding) {
-          case FIELD_ENCODING_DICT: {
-            for (auto &&it : storage.strval.dict.dict) {
-              roaring_bitmap_free(it.second);
-            }
+      case FIELD_TYPE_TIMESTAMP: {
+        for (auto &&granularity : storage.timeBuckets) {
+          for (auto &&bucket : granularity.second) {
+            roaring_bitmap_free(bucket.second);
           }
-          default: break;
         }
       } break;
+      case FIELD_TYPE_INT: {
+        delete storage.bsi;
+      } break;
+      case FIELD_TYPE_BOOLEAN: {
+        roaring_bitmap_free(storage.bvals);
+      } break;
       default: {
         break;
       }
@@ -80,23 +109,102 @@ class Field {
 
   void setEncoding(const int encoding_) {
     encoding = encoding_;
+
+    if (type == FIELD_TYPE_INT && encoding == FIELD_ENCODING_BSI && storage.bsi == nullptr) {
+      storage.bsi = new BitSlicedIndex();
+    }
   }
 
+  // empty field with the same type, encoding and indexes
+  Field *cloneDefinition() const;
+
+  // copy of the field and its rows. mapped columns are shared,
+  // frozen bitmaps are copied into memory.
+  Field *clone() const;
+
+  // keep per bucket bitmaps of given width for a timestamp field,
+  // existing rows are indexed too.
+  void addTimeBucketGranularity(int64_t seconds);
+
+  // keep dictionary id of every row of a dict field,
+  // existing rows are filled in too.
+  void enableRowIds();
+
+  // estimated number of distinct values, used by query planning
+  uint64_t estimateDistinctCount(const vector<string> &funcArgs);
+
+  // memory owned by the field, mapped snapshot data excluded
   int64_t statUsedMemory();
 
+  int64_t statMappedMemory() {
+    return mapping ? (int64_t) mapping->size : 0;
+  }
+
+  // writes definition and storage of the field
+  void save(SnapshotWriter &writer);
+
+  // reads a field written by save. caller owns the returned field.
+  static Field *load(SnapshotReader &reader);
+
+  // converts bitmaps to their best container types and
+  // releases unused capacity of columns. returns reclaimed bytes.
+  int64_t compact();
+
   void addValue(const GenericValueContainer &genericValueContainer);
 
-  roaring_bitmap_t *getBitmap(string op, string value);
+  // [from, to) range of timestamps matched by a timestamp filter
+  static void timestampFilterRange(const string &fieldName, const string &op, const string &value, int64_t *from, int64_t *to);
+
+  // owned is set to true when returned bitmap is created for this call
+  // and must be freed by the caller.
+  roaring_bitmap_t *getBitmap(string op, string value, bool &owned);
+
+  // filters taking a list of values, such as in and contains_any
+  roaring_bitmap_t *getBitmap(string op, const vector<string> &values, bool &owned);
 
   map<string, roaring_bitmap_t *> genGroups(roaring_bitmap_t *initialBitmap);
 
   map<string, roaring_bitmap_t *> genGroups(roaring_bitmap_t *initialBitmap, string func, vector<string> funcArgs);
 
-  uint64_t aggrFuncMin(roaring_bitmap_t *bitmap);
+  // dateSecondsGroup by reading timestamps of given rows in batches
+  void genDateSecondsGroupsScan(roaring_bitmap_t *initialBitmap, int64_t seconds, map<int64_t, roaring_bitmap_t *> &result);
+
+  // dateSecondsGroup using precomputed buckets of given granularity,
+  // seconds must be a multiple of granularity.
+  void genTimeBucketGroups(roaring_bitmap_t *initialBitmap, int64_t granularity, int64_t seconds, map<int64_t, roaring_bitmap_t *> &result);
+
+  // calls fn with batches of values of given rows, for timestamp, int and bigint fields.
+  // int values are sign extended, bigint ones are cast.
+  void scanInts(roaring_bitmap_t *bitmap, const function<void(const int64_t *values, uint32_t count)> &fn);
 
-  uint64_t aggrFuncMax(roaring_bitmap_t *bitmap);
+  // adds values of given rows to values, for string and boolean fields
+  void distinctStrings(roaring_bitmap_t *bitmap, unordered_set<string> &values);
 
-  uint64_t aggrFuncSum(roaring_bitmap_t *bitmap);
+  // adds values of given rows to values, for timestamp, int and bigint fields.
+  // int values are sign extended.
+  void distinctInts(roaring_bitmap_t *bitmap, unordered_set<uint64_t> &values);
+
+  // whether count_distinct collects values of this field with distinctStrings
+  bool hasStringValues() const {
+    return type == FIELD_TYPE_STRING || type == FIELD_TYPE_BOOLEAN;
+  }
+
+  // adds hashes of values of given rows to a sketch, for every field type
+  void addToSketch(roaring_bitmap_t *bitmap, HyperLogLog &sketch);
+
+  private:
+  // used by clone, bitmaps are copied after storage
+  Field(const Field &other);
+
+  // copies frozen bitmaps into memory
+  void thaw();
+
+  // values of given rows of a timestamp, int or bigint field, as scanInts passes them
+  void gatherInts(const uint32_t *rows, uint32_t count, int64_t *values);
+
+  int64_t ownedBitmapMemory(const roaring_bitmap_t *bitmap) {
+    return frozenBitmaps ? 0 : bitmapUsedMemory(bitmap);
+  }
 };
 
 #endif //MERLIN_FIELD_H
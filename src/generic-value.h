@@ -3,6 +3,7 @@
 //
 
 #include <string>
+#include <vector>
 //#include "field.h"
 #include "field-types.h"
 
@@ -17,16 +18,26 @@ class GenericValueContainer {
   int64_t i64Val;
   uint64_t u64Val;
   int iVal;
+  double dVal;
   string strVal;
+  // values of a multi value string field
+  vector<string> strArrVal;
+  // counts of a histogram aggregation
+  vector<uint64_t> u64ArrVal;
+  bool isArray = false;
   bool bVal;
   GenericValueContainer(int64_t i64Val_): i64Val(i64Val_) { type = FIELD_TYPE_TIMESTAMP; }
   GenericValueContainer(uint64_t u64Val_): u64Val(u64Val_) { type = FIELD_TYPE_BIGINT; }
   GenericValueContainer(int iVal_): iVal(iVal_) { type = FIELD_TYPE_INT; }
+  GenericValueContainer(double dVal_): dVal(dVal_) { type = FIELD_TYPE_DOUBLE; }
   GenericValueContainer(string strVal_): strVal(strVal_) { type = FIELD_TYPE_STRING; }
   GenericValueContainer(bool bVal_): bVal(bVal_) { type = FIELD_TYPE_BOOLEAN; }
+  GenericValueContainer(vector<string> strArrVal_): strArrVal(strArrVal_), isArray(true) { type = FIELD_TYPE_STRING; }
+  GenericValueContainer(vector<uint64_t> u64ArrVal_): u64ArrVal(u64ArrVal_), isArray(true) { type = FIELD_TYPE_BIGINT; }
   const inline int64_t getInt64Val () const { return i64Val; }
   const inline uint64_t getUInt64Val () const { return u64Val; }
   const inline int getIVal() const { return iVal; }
+  const inline double getDVal() const { return dVal; }
   const inline string getStrVal() const { return strVal; }
   const inline bool getBVal() const { return bVal; }
 };
@@ -1,10 +1,17 @@
 #include <iostream>
 #include <map>
+#include <thread>
+#include <chrono>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <netdb.h> // NI_MAXHOST, required by Simple-Web-Server
 #include <netinet/ip.h> // ip_mreq, required by Simple-Web-Server
 #include "table.h"
 #include "query.h"
 #include "server_http.hpp"
+#include "snapshot.h"
 #include "http.h"
 
 using namespace std;
@@ -12,20 +19,27 @@ using namespace std;
 map<string, int> fieldTypes = {
   {"timestamp", FIELD_TYPE_TIMESTAMP},
   {"string", FIELD_TYPE_STRING},
-  {"int", FIELD_TYPE_INT}
+  {"int", FIELD_TYPE_INT},
+  {"bigint", FIELD_TYPE_BIGINT},
+  {"boolean", FIELD_TYPE_BOOLEAN}
 };
 map<string, int> encodingTypes = {
-  {"dict", FIELD_ENCODING_DICT}
+  {"dict", FIELD_ENCODING_DICT},
+  {"multi_val", FIELD_ENCODING_MULTI_VAL},
+  {"bsi", FIELD_ENCODING_BSI}
 };
 map<int, string> fieldTypeToStr = {
   {FIELD_TYPE_TIMESTAMP, "timestamp"},
   {FIELD_TYPE_STRING, "string"},
-  {FIELD_TYPE_INT, "int"}
+  {FIELD_TYPE_INT, "int"},
+  {FIELD_TYPE_BIGINT, "bigint"},
+  {FIELD_TYPE_BOOLEAN, "boolean"}
 };
 map<int, string> encodingTypeToStr = {
   {FIELD_ENCODING_NONE, "none"},
   {FIELD_ENCODING_DICT, "dict"},
-  {FIELD_ENCODING_MULTI_VAL, "multi_val"}
+  {FIELD_ENCODING_MULTI_VAL, "multi_val"},
+  {FIELD_ENCODING_BSI, "bsi"}
 };
 
 typedef SimpleWeb::Server<SimpleWeb::HTTP> HttpServer;
@@ -72,19 +86,204 @@ void httpServerInit() {
   httpServer.commandHandlers["insert_into_table"] = commandInsertIntoTable;
   httpServer.commandHandlers["query_table"] = commandQueryTable;
   httpServer.commandHandlers["stats_table"] = commandTableStatistics;
+  httpServer.commandHandlers["compact_table"] = commandCompactTable;
+  httpServer.commandHandlers["snapshot"] = commandSnapshot;
 }
 
 void httpServerDeinit() {
+  lock_guard<mutex> guard(httpServer.lock);
+  lock_guard<mutex> sealGuard(httpServer.sealLock);
+
   for (auto &&it : httpServer.tables) {
     auto table = it.second;
     delete table;
   }
+
+  httpServer.tables.clear();
+}
+
+// compacts tables which received rows but no inserts for compactIdleSeconds
+static void compactIdleTables() {
+  for (;;) {
+    this_thread::sleep_for(chrono::seconds(1));
+
+    lock_guard<mutex> guard(httpServer.lock);
+    const auto now = time(nullptr);
+
+    for (auto &&it : httpServer.tables) {
+      auto table = it.second;
+
+      if (table->rowsSinceCompaction > 0 && now - table->lastInsertTime >= httpServer.compactIdleSeconds) {
+        table->compact();
+      }
+    }
+  }
+}
+
+// seals full segments of every table one by one. sealed copies are built
+// with the server lock released, so queries and inserts go on meanwhile.
+static void sealFullSegments(unique_lock<mutex> &guard) {
+  for (auto it = httpServer.tables.begin(); it != httpServer.tables.end();) {
+    const auto table = it->second;
+    const auto segment = table->startSealing();
+
+    if (segment == nullptr) {
+      it++;
+      continue;
+    }
+
+    Segment *sealed;
+    {
+      lock_guard<mutex> sealGuard(httpServer.sealLock);
+      guard.unlock();
+      sealed = segment->sealedCopy();
+    }
+    guard.lock();
+
+    // tables may have been dropped meanwhile, a new one may even reuse the address
+    it = httpServer.tables.begin();
+    while (it != httpServer.tables.end() && it->second != table) {
+      it++;
+    }
+
+    if (it == httpServer.tables.end() || table->sealing != segment) {
+      delete sealed;
+      it = httpServer.tables.begin();
+      continue;
+    }
+
+    table->finishSealing(sealed);
+  }
+}
+
+// seals segments filled by inserts, so inserts do not wait for it,
+// and drops partitions past the retention of their table
+static void maintainSegments() {
+  unique_lock<mutex> guard(httpServer.lock);
+
+  for (;;) {
+    httpServer.segmentsFull.wait_for(guard, chrono::seconds(1));
+    const auto now = time(nullptr);
+
+    for (auto &&it : httpServer.tables) {
+      it.second->dropExpiredPartitions(now);
+    }
+
+    sealFullSegments(guard);
+  }
 }
 
 void httpServerStop() {
   server.stop();
 }
 
+int64_t httpServerUsedMemory() {
+  int64_t sum = 0;
+
+  for (auto &&it : httpServer.tables) {
+    sum += MAP_NODE_OVERHEAD + sizeof(it) + it.first.capacity() + it.second->statUsedMemory();
+  }
+
+  return sum;
+}
+
+// applies pending changes whose records are on disk, in log order
+static void applyDurableChanges() {
+  const uint64_t durable = httpServer.wal->durableSequence();
+
+  while (!httpServer.pendingChanges.empty() && httpServer.pendingChanges.front()->sequence <= durable) {
+    auto change = httpServer.pendingChanges.front();
+    httpServer.pendingChanges.pop_front();
+    change->err = change->apply();
+    change->applied = true;
+  }
+}
+
+// releases the server lock for its lifetime
+struct ServerLockRelease {
+  ServerLockRelease() { httpServer.lock.unlock(); }
+  ~ServerLockRelease() { httpServer.lock.lock(); }
+};
+
+string httpServerCommit(uint8_t type, const string &payload, function<string()> apply) {
+  if (httpServer.wal == nullptr) {
+    return apply();
+  }
+
+  auto change = make_shared<PendingChange>();
+  change->sequence = httpServer.wal->append(type, payload);
+  change->apply = apply;
+  change->applied = false;
+  httpServer.pendingChanges.push_back(change);
+
+  try {
+    // other handlers run meanwhile, so their records join the same sync
+    ServerLockRelease release;
+    httpServer.wal->waitDurable(change->sequence);
+  } catch (std::runtime_error &e) {
+    // nothing logged after the failure can become durable
+    httpServer.pendingChanges.clear();
+    throw;
+  }
+
+  applyDurableChanges();
+
+  return change->err;
+}
+
+uint64_t httpServerSyncLog() {
+  if (httpServer.wal == nullptr) {
+    return 0;
+  }
+
+  // handlers waiting for these records find them applied
+  const uint64_t sequence = httpServer.wal->lastSequence();
+
+  try {
+    httpServer.wal->waitDurable(sequence);
+  } catch (std::runtime_error &e) {
+    httpServer.pendingChanges.clear();
+    throw;
+  }
+
+  applyDurableChanges();
+
+  return sequence;
+}
+
+// applies a record read from the log at startup
+static void replayChange(uint8_t type, const string &payload) {
+  string err;
+
+  switch (type) {
+    case WAL_RECORD_CREATE_TABLE: {
+      picojson::value req;
+      picojson::parse(req, payload.c_str(), payload.c_str() + payload.size(), &err);
+      if (err.empty() && req.is<picojson::object>()) {
+        err = applyCreateTable(req.get<picojson::object>());
+      }
+    } break;
+    case WAL_RECORD_DROP_TABLE: {
+      err = applyDropTable(payload);
+    } break;
+    case WAL_RECORD_INSERT: {
+      InsertBatch batch;
+      if (!batch.decode(payload.data(), payload.size())) {
+        throw std::runtime_error("invalid insert record in write ahead log");
+      }
+      err = applyInsertBatch(batch);
+    } break;
+    default: {
+      throw std::runtime_error("unknown record type in write ahead log: " + to_string(type));
+    }
+  }
+
+  // the change failed the same way when it was logged
+  if (!err.empty()) {
+    cerr << "skipped write ahead log record: " << err << endl;
+  }
+}
+
 // helper function for handlers
 void setError(picojson::object &res, string message) {
   res["stat"] = picojson::value("error");
@@ -119,7 +318,10 @@ void httpHandler(shared_ptr<HttpServer::Response> response, shared_ptr<HttpServe
 
   const string cmd = documentWrap.get("command").to_str();
   const auto handler = httpServer.commandHandlers[cmd];
-  handler(documentWrap.get<picojson::object>(), responseDocument);
+  {
+    lock_guard<mutex> guard(httpServer.lock);
+    handler(documentWrap.get<picojson::object>(), responseDocument);
+  }
 
   const auto responseString = picojson::value(responseDocument).serialize();
   res.end(responseString.c_str(), responseString.size());
@@ -146,6 +348,72 @@ int main() {
   // start http server
   httpServerInit();
 
+  // automatic compaction, disabled by default
+  if (getenv("MERLIN_COMPACT_EVERY_ROWS") != nullptr) {
+    httpServer.compactEveryRows = (uint32_t) strtoul(getenv("MERLIN_COMPACT_EVERY_ROWS"), nullptr, 10);
+  }
+
+  if (getenv("MERLIN_COMPACT_IDLE_SECONDS") != nullptr) {
+    httpServer.compactIdleSeconds = atoi(getenv("MERLIN_COMPACT_IDLE_SECONDS"));
+  }
+
+  // memory limits, disabled by default
+  if (getenv("MERLIN_TABLE_MEMORY_LIMIT") != nullptr) {
+    httpServer.tableMemoryLimit = strtoll(getenv("MERLIN_TABLE_MEMORY_LIMIT"), nullptr, 10);
+  }
+
+  if (getenv("MERLIN_MEMORY_LIMIT") != nullptr) {
+    httpServer.memoryLimit = strtoll(getenv("MERLIN_MEMORY_LIMIT"), nullptr, 10);
+  }
+
+  // threads of a query, queries may ask for their own with "parallelism"
+  if (getenv("MERLIN_QUERY_THREADS") != nullptr) {
+    Query::defaultParallelism = atoi(getenv("MERLIN_QUERY_THREADS"));
+  }
+
+  httpServer.dataDir = getenv("MERLIN_DATA_DIR") != nullptr ? getenv("MERLIN_DATA_DIR") : "data";
+
+  // inserts and table changes are logged before they are applied, MERLIN_WAL=0 disables it
+  const bool walEnabled = getenv("MERLIN_WAL") == nullptr || string(getenv("MERLIN_WAL")) != "0";
+  // how long the first waiter collects records before syncing, in microseconds
+  int64_t walCommitWindowUs = 0;
+
+  if (getenv("MERLIN_WAL_COMMIT_WINDOW_US") != nullptr) {
+    walCommitWindowUs = strtoll(getenv("MERLIN_WAL_COMMIT_WINDOW_US"), nullptr, 10);
+  }
+
+  try {
+    const auto start = chrono::system_clock::now();
+    uint64_t walSequence = 0;
+    // MERLIN_MMAP=1 queries sealed data from the mapped snapshot files
+    const char *mmapEnv = getenv("MERLIN_MMAP");
+    loadSnapshot(httpServer.dataDir, httpServer.tables, mmapEnv != nullptr && string(mmapEnv) == "1", &walSequence);
+
+    if (walEnabled) {
+      if (mkdir(httpServer.dataDir.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("could not create " + httpServer.dataDir + ": " + strerror(errno));
+      }
+
+      httpServer.wal = new WriteAheadLog(httpServer.dataDir + "/wal.log", walCommitWindowUs);
+      httpServer.wal->replay(walSequence, replayChange);
+    }
+
+    const chrono::duration<double> elapsed = chrono::system_clock::now() - start;
+
+    if (!httpServer.tables.empty()) {
+      cout << "loaded " << httpServer.tables.size() << " tables from " << httpServer.dataDir << " in " << elapsed.count() << " sec" << endl;
+    }
+  } catch (std::runtime_error &e) {
+    cerr << "could not load snapshot: " << e.what() << endl;
+    return 1;
+  }
+
+  thread(maintainSegments).detach();
+
+  if (httpServer.compactIdleSeconds > 0) {
+    thread(compactIdleTables).detach();
+  }
+
   cout << "starting http server on :3000" << endl;
 
   server.resource["/api/v1/command"]["POST"] = httpHandler;
@@ -160,9 +428,17 @@ int main() {
   };
 
   server.config.port = 3000;
+  // requests waiting for the log need other threads to share their sync
+  server.config.thread_pool_size = thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 4;
+
+  if (getenv("MERLIN_HTTP_THREADS") != nullptr) {
+    server.config.thread_pool_size = (size_t) strtoul(getenv("MERLIN_HTTP_THREADS"), nullptr, 10);
+  }
+
   server.start();
 
   httpServerDeinit();
+  delete httpServer.wal;
 
   return 0;
 }
@@ -1,4 +1,11 @@
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <functional>
 #include "table.h"
+#include "wal.h"
+#include "insert-batch.h"
 
 // picojson and roaring bitmap both declares this
 // but picojson does does not check whether this
@@ -16,9 +23,41 @@ using namespace std;
 
 typedef void (*CommandHandlerFunc) (picojson::object &req, picojson::object &res);
 
+// types of write ahead log records
+const uint8_t WAL_RECORD_CREATE_TABLE = 1; // create_table request as json
+const uint8_t WAL_RECORD_DROP_TABLE = 2;   // table name
+const uint8_t WAL_RECORD_INSERT = 3;       // encoded InsertBatch
+
+// a logged change waiting for its record to reach the disk.
+// changes are applied in log order, so replay ends up in the same state.
+struct PendingChange {
+  uint64_t sequence;
+  function<string()> apply;
+  bool applied;
+  string err;
+};
+
 struct MerlinHttpServer {
   map<string, CommandHandlerFunc> commandHandlers;
   map<string, Table *> tables;
+  // held while a command or a background job touches tables
+  mutex lock;
+  // signaled when a table has full segments to seal
+  condition_variable segmentsFull;
+  // held while a segment is sealed without the server lock.
+  // tables are deleted with it held, so the segment stays alive meanwhile.
+  mutex sealLock;
+  // automatic compaction triggers, 0 disables them
+  uint32_t compactEveryRows;
+  int compactIdleSeconds;
+  // memory limits in bytes checked before inserts, 0 disables them
+  int64_t tableMemoryLimit;
+  int64_t memoryLimit;
+  // tables are saved to and restored from here
+  string dataDir;
+  // null when the write ahead log is disabled
+  WriteAheadLog *wal;
+  deque<shared_ptr<PendingChange>> pendingChanges;
 };
 
 extern MerlinHttpServer httpServer;
@@ -29,6 +68,23 @@ extern map<int, string> encodingTypeToStr;
 
 void httpServerStop();
 
+// memory used by all tables
+int64_t httpServerUsedMemory();
+
+// logs a change and applies it once it is durable, returns the error of apply.
+// called by command handlers, the server lock is released while waiting for the disk.
+// throws when the log could not be written.
+string httpServerCommit(uint8_t type, const string &payload, function<string()> apply);
+
+// waits for every logged change and applies them, returns the last sequence.
+// called with the server lock held.
+uint64_t httpServerSyncLog();
+
+// appliers shared by command handlers and log replay, return an error message
+string applyCreateTable(picojson::object &req);
+string applyDropTable(const string &tableName);
+string applyInsertBatch(const InsertBatch &batch);
+
 // helper for command handlers
 void setError(picojson::object &res, string message);
 
@@ -41,5 +97,7 @@ void commandDropTable(picojson::object &req, picojson::object &res);
 void commandInsertIntoTable(picojson::object &req, picojson::object &res);
 void commandQueryTable(picojson::object &req, picojson::object &res);
 void commandTableStatistics(picojson::object &req, picojson::object &res);
+void commandCompactTable(picojson::object &req, picojson::object &res);
+void commandSnapshot(picojson::object &req, picojson::object &res);
 
 #endif //MERLIN_HTTP_H
@@ -0,0 +1,19 @@
+#include "../http.h"
+
+void commandCompactTable(picojson::object &req, picojson::object &res) {
+  string tableName;
+
+  if (!req["name"].is<string>()) {
+    return setError(res, "name prop is required");
+  }
+
+  tableName = req["name"].to_str();
+
+  if (httpServer.tables.count(tableName) == 0) {
+    return setError(res, "table not found");
+  }
+
+  Table *table = httpServer.tables[tableName];
+
+  res["reclaimed_bytes"] = picojson::value(table->compact());
+}
@@ -1,24 +1,11 @@
 #include "../http.h"
 
-void commandCreateTable(picojson::object &req, picojson::object &res) {
-  picojson::array tableNames;
-  string tableName;
+// builds the table described by a create_table request,
+// returns null and sets err when the request is not valid
+static Table *createTableFromRequest(picojson::object &req, string &err) {
   const auto fields = req["fields"];
-  string err;
   const auto table = new Table();
 
-  if (!req["name"].is<string>()) {
-    err = "table name is required";
-    goto error;
-  }
-
-  tableName = req["name"].to_str();
-
-  if (httpServer.tables.count(tableName) == 1) {
-    err = "table already exist";
-    goto error;
-  }
-
   if (!fields.is<picojson::array>()) {
     err = "fields prop is required.";
     goto error;
@@ -66,26 +53,210 @@ void commandCreateTable(picojson::object &req, picojson::object &res) {
         err = "dict encoding only usable with string fields at the moment";
         goto error;
       }
+
+      if (encoding == "multi_val" && type != "string") {
+        err = "multi_val encoding only usable with string fields";
+        goto error;
+      }
+
+      if (encoding == "bsi" && type != "int") {
+        err = "bsi encoding only usable with int fields";
+        goto error;
+      }
     }
 
     const auto mField = new Field(name, fieldTypes[type]);
 
     if (!encoding.empty()) {
-      mField->encoding = encodingTypes[encoding];
+      mField->setEncoding(encodingTypes[encoding]);
+    }
+
+    // per row dictionary ids, lets group by scan rows on high cardinality fields
+    if (obj["row_ids"].is<bool>() && obj["row_ids"].get<bool>()) {
+      if (mField->encoding != FIELD_ENCODING_DICT) {
+        delete mField;
+        err = "row_ids only usable with dict encoded fields";
+        goto error;
+      }
+
+      mField->enableRowIds();
+    }
+
+    // precomputed dateSecondsGroup buckets, e.g. [60, 3600, 86400]
+    if (!obj["bucket_granularities"].is<picojson::null>()) {
+      if (type != "timestamp" || !obj["bucket_granularities"].is<picojson::array>()) {
+        delete mField;
+        err = "bucket_granularities must be an array and only usable with timestamp fields";
+        goto error;
+      }
+
+      for (auto &&granularity : obj["bucket_granularities"].get<picojson::array>()) {
+        if (!granularity.is<double>() || granularity.get<int64_t>() <= 0) {
+          delete mField;
+          err = "bucket_granularities must contain positive integers";
+          goto error;
+        }
+
+        mField->addTimeBucketGranularity(granularity.get<int64_t>());
+      }
     }
 
     table->setField(mField);
   }
 
-  httpServer.tables[tableName] = table;
+  // {"field": "timestamp", "granularity": "day"}, each hour or day gets its own segments
+  if (!req["partition_by"].is<picojson::null>()) {
+    auto partitionBy = req["partition_by"];
+    int64_t seconds = 0;
 
-  res["created"] = picojson::value(true);
+    if (!partitionBy.is<picojson::object>() || !partitionBy.get("field").is<string>()) {
+      err = "partition_by must be an object having a field prop";
+      goto error;
+    }
 
-  return;
+    if (partitionBy.get("granularity").to_str() == "hour") {
+      seconds = 3600;
+    } else if (partitionBy.get("granularity").to_str() == "day") {
+      seconds = 86400;
+    } else {
+      err = "partition_by granularity must be hour or day";
+      goto error;
+    }
+
+    const auto partitionField = partitionBy.get("field").to_str();
+
+    if (table->fields.count(partitionField) == 0 || table->fields[partitionField]->type != FIELD_TYPE_TIMESTAMP) {
+      err = "partition_by field must be a timestamp field of the table";
+      goto error;
+    }
+
+    table->setPartitioning(partitionField, seconds);
+  }
+
+  // partitions older than this are dropped
+  if (!req["retention_seconds"].is<picojson::null>()) {
+    if (table->partitionSeconds == 0 || !req["retention_seconds"].is<double>() || req["retention_seconds"].get<int64_t>() <= 0) {
+      err = "retention_seconds must be a positive integer and only usable with partition_by";
+      goto error;
+    }
+
+    table->retentionSeconds = req["retention_seconds"].get<int64_t>();
+  }
+
+  // [{"name": "by_country", "dimensions": ["country"], "time_field": "timestamp",
+  //   "granularity": 3600, "metrics": [{"field": "duration", "func": "sum"}]}]
+  // inserts keep them up to date, queries they cover are answered from them.
+  if (!req["rollups"].is<picojson::null>()) {
+    if (!req["rollups"].is<picojson::array>()) {
+      err = "rollups must be an array";
+      goto error;
+    }
+
+    for (auto &&spec : req["rollups"].get<picojson::array>()) {
+      vector<string> dimensions;
+      vector<RollupMetric> metrics;
+
+      if (!spec.is<picojson::object>() || !spec.get("name").is<string>() || !spec.get("time_field").is<string>()) {
+        err = "rollups must be objects having name and time_field props";
+        goto error;
+      }
+
+      if (!spec.get("granularity").is<double>() || spec.get("granularity").get<int64_t>() <= 0) {
+        err = "rollup granularity must be a positive integer";
+        goto error;
+      }
+
+      if (!spec.get("dimensions").is<picojson::array>() || !spec.get("metrics").is<picojson::array>()) {
+        err = "rollup dimensions and metrics must be arrays";
+        goto error;
+      }
+
+      for (auto &&dimension : spec.get("dimensions").get<picojson::array>()) {
+        if (!dimension.is<string>()) {
+          err = "rollup dimensions must be field names";
+          goto error;
+        }
+        dimensions.push_back(dimension.get<string>());
+      }
+
+      for (auto &&metric : spec.get("metrics").get<picojson::array>()) {
+        if (!metric.is<picojson::object>() || !metric.get("field").is<string>() || !metric.get("func").is<string>()) {
+          err = "rollup metrics must be objects having field and func props";
+          goto error;
+        }
+        metrics.push_back(RollupMetric{metric.get("field").get<string>(), metric.get("func").get<string>(), 0});
+      }
+
+      try {
+        table->addRollup(new Rollup(spec.get("name").get<string>(), spec.get("time_field").get<string>(), spec.get("granularity").get<int64_t>(), dimensions, metrics));
+      } catch (std::runtime_error &e) {
+        err = e.what();
+        goto error;
+      }
+    }
+  }
+
+  return table;
 
   error:
 
   delete table;
 
-  return setError(res, err);
+  return nullptr;
+}
+
+string applyCreateTable(picojson::object &req) {
+  string err;
+  const string tableName = req["name"].to_str();
+
+  // a table with the same name may be created while the request waited for the log
+  if (httpServer.tables.count(tableName) == 1) {
+    return "table already exist";
+  }
+
+  const auto table = createTableFromRequest(req, err);
+
+  if (table == nullptr) {
+    return err;
+  }
+
+  httpServer.tables[tableName] = table;
+
+  return "";
+}
+
+void commandCreateTable(picojson::object &req, picojson::object &res) {
+  string err;
+
+  if (!req["name"].is<string>()) {
+    return setError(res, "table name is required");
+  }
+
+  if (httpServer.tables.count(req["name"].to_str()) == 1) {
+    return setError(res, "table already exist");
+  }
+
+  // validate before logging, the table is built again when the record is applied
+  const auto table = createTableFromRequest(req, err);
+
+  if (table == nullptr) {
+    return setError(res, err);
+  }
+
+  delete table;
+
+  try {
+    picojson::object request = req;
+    err = httpServerCommit(WAL_RECORD_CREATE_TABLE, picojson::value(req).serialize(), [request]() mutable {
+      return applyCreateTable(request);
+    });
+  } catch (std::runtime_error &e) {
+    return setError(res, e.what());
+  }
+
+  if (!err.empty()) {
+    return setError(res, err);
+  }
+
+  res["created"] = picojson::value(true);
 }
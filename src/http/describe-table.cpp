@@ -24,9 +24,60 @@ void commandDescribeTable(picojson::object &req, picojson::object &res) {
     obj["type"] = picojson::value(fieldTypeToStr[field->type]);
     obj["encoding"] = picojson::value(encodingTypeToStr[field->encoding]);
 
+    if (field->encoding == FIELD_ENCODING_DICT) {
+      obj["row_ids"] = picojson::value(field->storage.strval.dict.hasRowIds);
+    }
+
+    if (!field->storage.timeBuckets.empty()) {
+      picojson::array granularities;
+      for (auto &&granularity : field->storage.timeBuckets) {
+        granularities.push_back(picojson::value(granularity.first));
+      }
+      obj["bucket_granularities"] = picojson::value(granularities);
+    }
+
     fields.push_back(picojson::value(obj));
   }
 
   res["fields"] = picojson::value(fields);
   res["record_count"] = picojson::value((int64_t) table->size);
+
+  if (table->partitionSeconds > 0) {
+    picojson::object partitionBy;
+    partitionBy["field"] = picojson::value(table->partitionField);
+    partitionBy["granularity"] = picojson::value(table->partitionSeconds == 3600 ? "hour" : "day");
+    res["partition_by"] = picojson::value(partitionBy);
+    res["retention_seconds"] = picojson::value(table->retentionSeconds);
+  }
+
+  if (!table->rollups.empty()) {
+    picojson::array rollups;
+
+    for (auto &&rollup : table->rollups) {
+      picojson::object obj;
+      picojson::array dimensions;
+      picojson::array metrics;
+
+      for (auto &&dimension : rollup->dimensions) {
+        dimensions.push_back(picojson::value(dimension));
+      }
+
+      for (auto &&metric : rollup->metrics) {
+        picojson::object metricObj;
+        metricObj["field"] = picojson::value(metric.field);
+        metricObj["func"] = picojson::value(metric.func);
+        metrics.push_back(picojson::value(metricObj));
+      }
+
+      obj["name"] = picojson::value(rollup->name);
+      obj["time_field"] = picojson::value(rollup->timeField);
+      obj["granularity"] = picojson::value(rollup->granularity);
+      obj["dimensions"] = picojson::value(dimensions);
+      obj["metrics"] = picojson::value(metrics);
+      obj["row_count"] = picojson::value((int64_t) rollup->size());
+      rollups.push_back(picojson::value(obj));
+    }
+
+    res["rollups"] = picojson::value(rollups);
+  }
 }
@@ -1,8 +1,23 @@
 #include "../http.h"
 
+string applyDropTable(const string &tableName) {
+  if (httpServer.tables.count(tableName) == 0) {
+    return "table not found";
+  }
+
+  const Table *table = httpServer.tables[tableName];
+  httpServer.tables.erase(tableName);
+
+  // waits for a segment of the table being sealed
+  lock_guard<mutex> sealGuard(httpServer.sealLock);
+  delete table;
+
+  return "";
+}
+
 void commandDropTable(picojson::object &req, picojson::object &res) {
-  picojson::array fields;
   string tableName;
+  string err;
 
   if (!req["name"].is<string>()) {
     return setError(res, "name prop is required");
@@ -14,10 +29,17 @@ void commandDropTable(picojson::object &req, picojson::object &res) {
     return setError(res, "table not found");
   }
 
-  const Table *table = httpServer.tables[tableName];
-  httpServer.tables.erase(tableName);
+  try {
+    err = httpServerCommit(WAL_RECORD_DROP_TABLE, tableName, [tableName]() {
+      return applyDropTable(tableName);
+    });
+  } catch (std::runtime_error &e) {
+    return setError(res, e.what());
+  }
 
-  delete table;
+  if (!err.empty()) {
+    return setError(res, err);
+  }
 
   res["dropped"] = picojson::value(true);
 }
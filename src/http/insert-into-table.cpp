@@ -1,10 +1,73 @@
 #include "../http.h"
 
+// checks whether rowCount more rows fit into memory limits,
+// growth is estimated from average row size of the table.
+// limits are checked against memory counters of tables, only
+// compacting them once before giving up walks their segments.
+static bool checkMemoryLimits(Table *table, size_t rowCount, string &err) {
+  if (httpServer.tableMemoryLimit <= 0 && httpServer.memoryLimit <= 0) {
+    return true;
+  }
+
+  for (bool compacted = false; ; compacted = true) {
+    const int64_t tableUsed = table->usedMemory;
+    const int64_t totalUsed = Table::totalUsedMemory();
+    const int64_t growth = table->size > 0 ? tableUsed / (int64_t) table->size * (int64_t) rowCount : 0;
+    const bool tableOver = httpServer.tableMemoryLimit > 0 && tableUsed + growth > httpServer.tableMemoryLimit;
+    const bool totalOver = httpServer.memoryLimit > 0 && totalUsed + growth > httpServer.memoryLimit;
+
+    if (!tableOver && !totalOver) {
+      return true;
+    }
+
+    if (compacted) {
+      err = tableOver
+            ? "table memory limit exceeded: " + to_string(tableUsed) + " of " + to_string(httpServer.tableMemoryLimit) + " bytes used"
+            : "memory limit exceeded: " + to_string(totalUsed) + " of " + to_string(httpServer.memoryLimit) + " bytes used";
+      return false;
+    }
+
+    for (auto &&it : httpServer.tables) {
+      if (it.second->rowsSinceCompaction > 0 && (totalOver || it.second == table)) {
+        it.second->compact();
+      }
+    }
+  }
+}
+
+string applyInsertBatch(const InsertBatch &batch) {
+  string err;
+
+  if (httpServer.tables.count(batch.table) == 0) {
+    return "table not found";
+  }
+
+  Table *table = httpServer.tables[batch.table];
+
+  if (!batch.apply(table, err)) {
+    return err;
+  }
+
+  table->lastInsertTime = time(nullptr);
+
+  if (table->hasFullSegments()) {
+    httpServer.segmentsFull.notify_one();
+  }
+
+  if (httpServer.compactEveryRows > 0 && table->rowsSinceCompaction >= httpServer.compactEveryRows) {
+    table->compact();
+  }
+
+  return "";
+}
+
 void commandInsertIntoTable(picojson::object &req, picojson::object &res) {
-  picojson::array fields;
   string tableName;
   string err;
+  string payload;
   auto rows = req["rows"];
+  // every row is validated before anything is logged or applied
+  auto batch = make_shared<InsertBatch>();
 
   if (!req["name"].is<string>()) {
     return setError(res, "name prop is required");
@@ -22,6 +85,20 @@ void commandInsertIntoTable(picojson::object &req, picojson::object &res) {
 
   Table *table = httpServer.tables[tableName];
 
+  if (!checkMemoryLimits(table, rows.get<picojson::array>().size(), err)) {
+    goto error;
+  }
+
+  batch->table = tableName;
+  batch->rowCount = (uint32_t) rows.get<picojson::array>().size();
+
+  for (auto &&fieldIter : table->fields) {
+    batch->fields.push_back(fieldIter.first);
+    batch->types.push_back(fieldIter.second->type);
+    batch->columns.emplace_back();
+    batch->columns.back().reserve(batch->rowCount);
+  }
+
   for (auto &&row : rows.get<picojson::array>()) {
     if (!row.is<picojson::object>()) {
       err = "each row must be an object";
@@ -29,22 +106,65 @@ void commandInsertIntoTable(picojson::object &req, picojson::object &res) {
     }
 
     picojson::object& obj = row.get<picojson::object>();
+    size_t column = 0;
 
     for (auto &&fieldIter : table->fields) {
       auto field = fieldIter.second;
+      auto &values = batch->columns[column++];
       auto value = obj[field->name];
       if (value.is<double>()) {
         if (field->type == FIELD_TYPE_TIMESTAMP) {
-          field->addValue(std::move(GenericValueContainer(value.get<int64_t>())));
+          values.emplace_back(value.get<int64_t>());
         } else if (field->type == FIELD_TYPE_INT) {
-          field->addValue(std::move(GenericValueContainer((int) value.get<int64_t>())));
+          const auto intValue = value.get<int64_t>();
+          if (intValue < INT32_MIN || intValue > INT32_MAX) {
+            err = "value out of int range for field: " + field->name;
+            goto error;
+          }
+          values.emplace_back((int) intValue);
+        } else if (field->type == FIELD_TYPE_BIGINT && value.get<int64_t>() >= 0) {
+          values.emplace_back((uint64_t) value.get<int64_t>());
+        } else {
+          err = "invalid value type for field: " + field->name;
+          goto error;
+        }
+      } else if (value.is<picojson::array>()) {
+        vector<string> tags;
+
+        if (field->type != FIELD_TYPE_STRING || field->encoding != FIELD_ENCODING_MULTI_VAL) {
+          err = "arrays are only accepted by multi_val fields: " + field->name;
+          goto error;
+        }
+
+        for (auto &&tag : value.get<picojson::array>()) {
+          if (!tag.is<string>()) {
+            err = "multi_val field values must be strings: " + field->name;
+            goto error;
+          }
+          tags.push_back(tag.get<string>());
+        }
+
+        values.emplace_back(tags);
+      } else if (value.is<bool>()) {
+        if (field->type == FIELD_TYPE_BOOLEAN) {
+          values.emplace_back(value.get<bool>());
         } else {
           err = "invalid value type for field: " + field->name;
           goto error;
         }
       } else if (value.is<string>()) {
         if (field->type == FIELD_TYPE_STRING) {
-          field->addValue(std::move(GenericValueContainer(value.to_str())));
+          values.emplace_back(value.to_str());
+        } else if (field->type == FIELD_TYPE_BIGINT) {
+          // bigint values above int64 range can only be sent as strings
+          char *end = nullptr;
+          const auto str = value.to_str();
+          const uint64_t u64Val = strtoull(str.c_str(), &end, 10);
+          if (str.empty() || str[0] == '-' || *end != '\0') {
+            err = "invalid bigint value for field: " + field->name;
+            goto error;
+          }
+          values.emplace_back(u64Val);
         } else {
           err = "invalid value type for field: " + field->name;
           goto error;
@@ -54,9 +174,20 @@ void commandInsertIntoTable(picojson::object &req, picojson::object &res) {
         goto error;
       }
     }
+  }
 
-    table->incrementRecordCount();
+  batch->encode(payload);
+
+  try {
+    err = httpServerCommit(WAL_RECORD_INSERT, payload, [batch]() {
+      return applyInsertBatch(*batch);
+    });
+  } catch (std::runtime_error &e) {
+    err = e.what();
+  }
 
+  if (!err.empty()) {
+    goto error;
   }
 
   res["inserted"] = picojson::value(true);
@@ -2,6 +2,113 @@
 #include "../http.h"
 #include "../query.h"
 
+// {"field": "country", "operator": "!=", "value": "US"},
+// {"field": "endpoint", "operator": "in", "value": ["/a", "/b"]} or
+// {"and": [...]}, {"or": [...]}, {"not": {...}} of other filters.
+// returns null and sets err when the filter is not valid.
+static FilterExpr *parseFilter(picojson::value &row, string &err) {
+  if (!row.is<picojson::object>()) {
+    err = "each filter must be an object";
+    return nullptr;
+  }
+
+  picojson::object& obj = row.get<picojson::object>();
+  string field;
+  string op;
+  string value;
+  vector<string> values;
+
+  for (auto &&logical : {"and", "or", "not"}) {
+    if (obj.count(logical) == 0) {
+      continue;
+    }
+
+    vector<FilterExpr *> children;
+    picojson::array operands;
+
+    if (string(logical) == "not") {
+      operands.push_back(obj[logical]);
+    } else if (obj[logical].is<picojson::array>() && !obj[logical].get<picojson::array>().empty()) {
+      operands = obj[logical].get<picojson::array>();
+    } else {
+      err = string("filters: ") + logical + " expects a non empty list of filters";
+      return nullptr;
+    }
+
+    for (auto &&operand : operands) {
+      const auto child = parseFilter(operand, err);
+
+      if (child == nullptr) {
+        for (auto &&parsed : children) {
+          delete parsed;
+        }
+        return nullptr;
+      }
+
+      children.push_back(child);
+    }
+
+    return new FilterExpr(logical, children);
+  }
+
+  if (!obj["field"].is<string>()) {
+    err = "filters: field prop is required in each filter obj.";
+    return nullptr;
+  }
+
+  field = obj["field"].get<string>();
+
+  if (field.empty()) {
+    err = "filters: field can not be empty";
+    return nullptr;
+  }
+
+  if (!obj["operator"].is<string>()) {
+    err = "filters: field prop is required in each filter obj.";
+    return nullptr;
+  }
+
+  op = obj["operator"].get<string>();
+
+  if (op.empty()) {
+    err = "filters: operator can not be empty";
+    return nullptr;
+  }
+
+  if (obj["value"].is<picojson::array>()) {
+    for (auto &&item : obj["value"].get<picojson::array>()) {
+      if (!item.is<string>() && !item.is<double>()) {
+        err = "filters: value list can only contain strings and numbers";
+        return nullptr;
+      }
+      values.push_back(item.to_str());
+    }
+
+    if (values.empty()) {
+      err = "filters: value list can not be empty";
+      return nullptr;
+    }
+
+    return new FilterExpr(field, op, values);
+  }
+
+  if (obj["value"].is<double>()) {
+    value = obj["value"].to_str();
+  } else if (obj["value"].is<string>()) {
+    value = obj["value"].get<string>();
+  } else {
+    err = "filters: value prop is required in each filter obj.";
+    return nullptr;
+  }
+
+  if (value.empty()) {
+    err = "filters: value can not be empty";
+    return nullptr;
+  }
+
+  return new FilterExpr(field, op, value);
+}
+
 void commandQueryTable(picojson::object &req, picojson::object &res) {
   Query *query = nullptr;
   picojson::array fields;
@@ -58,6 +165,10 @@ void commandQueryTable(picojson::object &req, picojson::object &res) {
     query->limit = limit;
   }
 
+  if (req["parallelism"].is<double>()) {
+    query->parallelism = (int) req["parallelism"].get<int64_t>();
+  }
+
   for (auto &&row : req["select"].get<picojson::array>()) {
     if (!row.is<picojson::object>()) {
       err = "each select expression must be an object";
@@ -93,6 +204,12 @@ void commandQueryTable(picojson::object &req, picojson::object &res) {
       selectExpr->isAggerationSelect = true;
     }
 
+    if (obj["aggr_func_args"].is<picojson::array>()) {
+      for (auto &&arg : obj["aggr_func_args"].get<picojson::array>()) {
+        selectExpr->aggerationFuncArgs.push_back(arg.to_str());
+      }
+    }
+
     // add this information to selectedFields array
     if (!selectExpr->display.empty()) {
       selectedFields.push_back(picojson::value(selectExpr->display));
@@ -106,54 +223,13 @@ void commandQueryTable(picojson::object &req, picojson::object &res) {
   }
 
   for (auto &&row : req["filters"].get<picojson::array>()) {
-    if (!row.is<picojson::object>()) {
-      err = "each filter must be an object";
-      goto error;
-    }
-
-    picojson::object& obj = row.get<picojson::object>();
-    string field;
-    string op;
-    string value;
-
-    if (!obj["field"].is<string>()) {
-      err = "filters: field prop is required in each filter obj.";
-      goto error;
-    }
-
-    field = obj["field"].get<string>();
+    const auto filterExpr = parseFilter(row, err);
 
-    if (field.empty()) {
-      err = "filters: field can not be empty";
-      goto error;
-    }
-
-    if (!obj["operator"].is<string>()) {
-      err = "filters: field prop is required in each filter obj.";
-      goto error;
-    }
-
-    op = obj["operator"].get<string>();
-
-    if (op.empty()) {
-      err = "filters: operator can not be empty";
+    if (filterExpr == nullptr) {
       goto error;
     }
 
-    if (!obj["value"].is<string>()) {
-      err = "filters: value prop is required in each filter obj.";
-      goto error;
-    }
-
-    value = obj["value"].get<string>();
-
-    if (value.empty()) {
-      err = "filters: value can not be empty";
-      goto error;
-    }
-
-    cout << "new filter: " << field << op << value << endl;
-    query->filterExprs.push_back(new FilterExpr(field, op, value));
+    query->filterExprs.push_back(filterExpr);
   }
 
   for (auto &&row : req["group_by"].get<picojson::array>()) {
@@ -213,7 +289,13 @@ void commandQueryTable(picojson::object &req, picojson::object &res) {
   start = std::chrono::system_clock::now();
 
   query->isAggregationQuery = true;
-  query->run();
+
+  try {
+    query->run();
+  } catch (std::runtime_error &e) {
+    err = e.what();
+    goto error;
+  }
 
   elapsed = std::chrono::system_clock::now() - start;
   milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
@@ -227,8 +309,16 @@ void commandQueryTable(picojson::object &req, picojson::object &res) {
         picoRow.push_back(picojson::value(value->getStrVal()));
       } else if (value->type == FIELD_TYPE_TIMESTAMP) {
         picoRow.push_back(picojson::value(value->getInt64Val()));
+      } else if (value->type == FIELD_TYPE_BIGINT && value->isArray) {
+        picojson::array counts;
+        for (auto &&count : value->u64ArrVal) {
+          counts.push_back(picojson::value((int64_t) count));
+        }
+        picoRow.push_back(picojson::value(counts));
       } else if (value->type == FIELD_TYPE_BIGINT) {
         picoRow.push_back(picojson::value((int64_t) value->getUInt64Val()));
+      } else if (value->type == FIELD_TYPE_DOUBLE) {
+        picoRow.push_back(picojson::value(value->getDVal()));
       } else {
         err = "invalid result row value type: " + to_string(value->type);
         goto error;
@@ -245,6 +335,11 @@ void commandQueryTable(picojson::object &req, picojson::object &res) {
     queryStats["group_ms"] = picojson::value(query->stats.group_ms);
     queryStats["order_us"] = picojson::value(query->stats.order_us);
     queryStats["order_ms"] = picojson::value(query->stats.order_ms);
+    queryStats["scratch_bytes"] = picojson::value(query->stats.scratch_bytes);
+    queryStats["skipped_segments"] = picojson::value(query->stats.skipped_segments);
+    if (query->rollup != nullptr) {
+      queryStats["rollup"] = picojson::value(query->rollup->name);
+    }
     res["query_stats_detailed"] = picojson::value(queryStats);
   }
 
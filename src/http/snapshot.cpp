@@ -0,0 +1,25 @@
+#include <chrono>
+#include "../snapshot.h"
+#include "../http.h"
+
+void commandSnapshot(picojson::object &req, picojson::object &res) {
+  const auto start = chrono::system_clock::now();
+
+  try {
+    // the snapshot contains every logged change, so the log can start over
+    const uint64_t walSequence = httpServerSyncLog();
+    saveSnapshot(httpServer.dataDir, httpServer.tables, walSequence);
+
+    if (httpServer.wal != nullptr) {
+      httpServer.wal->truncate();
+    }
+  } catch (std::runtime_error &e) {
+    return setError(res, e.what());
+  }
+
+  const chrono::duration<double> elapsed = chrono::system_clock::now() - start;
+
+  res["saved"] = picojson::value(true);
+  res["table_count"] = picojson::value((int64_t) httpServer.tables.size());
+  res["elapsed_ms"] = picojson::value((int64_t) (elapsed.count() * 1000));
+}
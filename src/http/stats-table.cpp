@@ -14,7 +14,7 @@ void commandTableStatistics(picojson::object &req, picojson::object &res) {
     return setError(res, "table not found");
   }
 
-  const Table *table = httpServer.tables[tableName];
+  Table *table = httpServer.tables[tableName];
 
   for (auto &&iter : table->fields) {
     const auto field = iter.second;
@@ -23,11 +23,18 @@ void commandTableStatistics(picojson::object &req, picojson::object &res) {
     obj["name"] = picojson::value(field->name);
     obj["type"] = picojson::value(fieldTypeToStr[field->type]);
     obj["encoding"] = picojson::value(encodingTypeToStr[field->encoding]);
-    obj["used_memory_estimate"] = picojson::value(field->statUsedMemory());
+    obj["used_memory_estimate"] = picojson::value(table->statFieldUsedMemory(field->name));
+    obj["mapped_memory"] = picojson::value(table->statFieldMappedMemory(field->name));
 
     fields.push_back(picojson::value(obj));
   }
 
   res["fields"] = picojson::value(fields);
   res["record_count"] = picojson::value((int64_t) table->size);
+  res["segment_count"] = picojson::value((int64_t) table->segmentCount());
+  res["partition_count"] = picojson::value((int64_t) table->partitionCount());
+  res["used_memory"] = picojson::value(table->statUsedMemory());
+  res["memory_limit"] = picojson::value(httpServer.tableMemoryLimit);
+  res["total_used_memory"] = picojson::value(httpServerUsedMemory());
+  res["total_memory_limit"] = picojson::value(httpServer.memoryLimit);
 }
@@ -0,0 +1,46 @@
+#include <algorithm>
+#include <math.h>
+#include "hyperloglog.h"
+
+using namespace std;
+
+void HyperLogLog::merge(const HyperLogLog &other) {
+  if (other.registers.empty()) {
+    return;
+  }
+
+  if (registers.empty()) {
+    registers = other.registers;
+    return;
+  }
+
+  for (uint32_t i = 0; i < HLL_REGISTERS; i++) {
+    registers[i] = std::max(registers[i], other.registers[i]);
+  }
+}
+
+uint64_t HyperLogLog::estimate() const {
+  if (registers.empty()) {
+    return 0;
+  }
+
+  const double m = HLL_REGISTERS;
+  const double alpha = 0.7213 / (1 + 1.079 / m);
+  double sum = 0;
+  uint32_t zeros = 0;
+
+  for (auto &&rank : registers) {
+    sum += ldexp(1.0, -rank);
+    zeros += rank == 0;
+  }
+
+  const double estimate = alpha * m * m / sum;
+
+  // small cardinalities leave registers empty, linear counting is closer there.
+  // 64 bit hashes need no large range correction.
+  if (estimate <= 2.5 * m && zeros > 0) {
+    return (uint64_t) llround(m * log(m / zeros));
+  }
+
+  return (uint64_t) llround(estimate);
+}
@@ -0,0 +1,71 @@
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#ifndef MERLIN_HYPERLOGLOG_H
+#define MERLIN_HYPERLOGLOG_H
+
+using namespace std;
+
+// 2^HLL_PRECISION registers, about 1.6% standard error in 4 KB
+const int HLL_PRECISION = 12;
+const uint32_t HLL_REGISTERS = 1 << HLL_PRECISION;
+
+// 64 bit hashes of values counted by sketches.
+// sketches are persisted, so these must not change between runs.
+inline uint64_t hashValue(uint64_t value) {
+  // murmur3 finalizer
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdULL;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53ULL;
+  value ^= value >> 33;
+  return value;
+}
+
+inline uint64_t hashValue(const char *data, size_t len) {
+  // fnv-1a, finalized to spread its low entropy bits
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ (uint8_t) data[i]) * 0x100000001b3ULL;
+  }
+
+  return hashValue(hash);
+}
+
+inline uint64_t hashValue(const string &value) {
+  return hashValue(value.data(), value.size());
+}
+
+// approximate distinct count of hashed values.
+// registers are allocated by the first add or merge, so empty sketches are cheap.
+class HyperLogLog {
+  public:
+  vector<uint8_t> registers;
+
+  void add(uint64_t hash) {
+    if (registers.empty()) {
+      registers.resize(HLL_REGISTERS, 0);
+    }
+
+    const auto index = hash >> (64 - HLL_PRECISION);
+    // the low bit stops the count when remaining bits are all zero
+    const auto rest = (hash << HLL_PRECISION) | (1ULL << (HLL_PRECISION - 1));
+    const auto rank = (uint8_t) (__builtin_clzll(rest) + 1);
+
+    if (rank > registers[index]) {
+      registers[index] = rank;
+    }
+  }
+
+  void merge(const HyperLogLog &other);
+
+  uint64_t estimate() const;
+
+  int64_t statUsedMemory() const {
+    return registers.capacity();
+  }
+};
+
+#endif //MERLIN_HYPERLOGLOG_H
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <string.h>
+#include "insert-batch.h"
+#include "table.h"
+
+using namespace std;
+
+template <typename T>
+static inline void put(string &out, T value) {
+  out.append((const char *) &value, sizeof(value));
+}
+
+static inline void putString(string &out, const string &value) {
+  put(out, (uint32_t) value.size());
+  out.append(value);
+}
+
+// bounds checked reads from an encoded batch
+class BatchReader {
+  public:
+  BatchReader(const char *data_, size_t size_): failed(false), data(data_), size(size_), position(0) {}
+
+  template <typename T>
+  T get() {
+    T value = T();
+    if (sizeof(value) > size - position) {
+      failed = true;
+      return value;
+    }
+    memcpy(&value, data + position, sizeof(value));
+    position += sizeof(value);
+    return value;
+  }
+
+  string getString() {
+    const auto length = get<uint32_t>();
+    if (failed || length > size - position) {
+      failed = true;
+      return string();
+    }
+    position += length;
+    return string(data + position - length, length);
+  }
+
+  bool ok() const {
+    return !failed && position == size;
+  }
+
+  bool failed;
+
+  private:
+  const char *data;
+  size_t size;
+  size_t position;
+};
+
+void InsertBatch::encode(string &out) const {
+  putString(out, table);
+  put(out, rowCount);
+  put(out, (uint32_t) fields.size());
+
+  for (size_t i = 0; i < fields.size(); i++) {
+    putString(out, fields[i]);
+    put(out, (uint8_t) types[i]);
+
+    for (auto &&value : columns[i]) {
+      switch (types[i]) {
+        case FIELD_TYPE_TIMESTAMP: put(out, value.i64Val); break;
+        case FIELD_TYPE_INT: put(out, (int32_t) value.iVal); break;
+        case FIELD_TYPE_BIGINT: put(out, value.u64Val); break;
+        case FIELD_TYPE_BOOLEAN: put(out, (uint8_t) value.bVal); break;
+        case FIELD_TYPE_STRING: {
+          put(out, (uint8_t) value.isArray);
+          if (value.isArray) {
+            put(out, (uint32_t) value.strArrVal.size());
+            for (auto &&tag : value.strArrVal) {
+              putString(out, tag);
+            }
+          } else {
+            putString(out, value.strVal);
+          }
+        } break;
+      }
+    }
+  }
+}
+
+bool InsertBatch::decode(const char *data, size_t size) {
+  BatchReader reader(data, size);
+
+  table = reader.getString();
+  rowCount = reader.get<uint32_t>();
+  const auto fieldCount = reader.get<uint32_t>();
+
+  for (uint32_t i = 0; i < fieldCount && !reader.failed; i++) {
+    fields.push_back(reader.getString());
+    types.push_back(reader.get<uint8_t>());
+    columns.emplace_back();
+
+    auto &column = columns.back();
+    column.reserve(rowCount);
+
+    for (uint32_t row = 0; row < rowCount && !reader.failed; row++) {
+      switch (types.back()) {
+        case FIELD_TYPE_TIMESTAMP: column.emplace_back(reader.get<int64_t>()); break;
+        case FIELD_TYPE_INT: column.emplace_back((int) reader.get<int32_t>()); break;
+        case FIELD_TYPE_BIGINT: column.emplace_back(reader.get<uint64_t>()); break;
+        case FIELD_TYPE_BOOLEAN: column.emplace_back(reader.get<uint8_t>() != 0); break;
+        case FIELD_TYPE_STRING: {
+          if (reader.get<uint8_t>() != 0) {
+            vector<string> tags;
+            for (auto tagCount = reader.get<uint32_t>(); tagCount > 0 && !reader.failed; tagCount--) {
+              tags.push_back(reader.getString());
+            }
+            column.emplace_back(tags);
+          } else {
+            column.emplace_back(reader.getString());
+          }
+        } break;
+        default: return false;
+      }
+    }
+  }
+
+  return reader.ok();
+}
+
+bool InsertBatch::apply(Table *table, string &err) const {
+  if (table->fields.size() != fields.size()) {
+    err = "fields of table " + this->table + " changed";
+    return false;
+  }
+
+  for (size_t i = 0; i < fields.size(); i++) {
+    const auto it = table->fields.find(fields[i]);
+    if (it == table->fields.end() || it->second->type != types[i]) {
+      err = "fields of table " + this->table + " changed";
+      return false;
+    }
+  }
+
+  const vector<GenericValueContainer> *partitionColumn = nullptr;
+
+  for (size_t i = 0; i < fields.size(); i++) {
+    if (table->partitionSeconds > 0 && fields[i] == table->partitionField) {
+      partitionColumn = &columns[i];
+    }
+  }
+
+  // rows are split at partition and segment boundaries.
+  // rows of a batch mostly fall into one partition, so they are moved in runs.
+  for (uint32_t start = 0; start < rowCount; ) {
+    const int64_t partition = partitionColumn != nullptr ? table->partitionOf((*partitionColumn)[start].i64Val) : 0;
+    const auto head = table->head(partition);
+    uint32_t end = start + std::min(rowCount - start, table->segmentRows - head->size);
+
+    if (partitionColumn != nullptr) {
+      for (uint32_t row = start + 1; row < end; row++) {
+        if (table->partitionOf((*partitionColumn)[row].i64Val) != partition) {
+          end = row;
+          break;
+        }
+      }
+    }
+
+    for (size_t i = 0; i < fields.size(); i++) {
+      const auto field = head->fields[fields[i]];
+      for (uint32_t row = start; row < end; row++) {
+        field->addValue(columns[i][row]);
+      }
+    }
+
+    table->addRows(end - start, partition);
+    start = end;
+  }
+
+  for (auto &&rollup : table->rollups) {
+    rollup->add(*this);
+  }
+
+  return true;
+}
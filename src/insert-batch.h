@@ -0,0 +1,36 @@
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "generic-value.h"
+
+#ifndef MERLIN_INSERT_BATCH_H
+#define MERLIN_INSERT_BATCH_H
+
+using namespace std;
+
+class Table;
+
+// validated rows of an insert, stored column by column.
+// columns follow the field order of the table at validation time.
+class InsertBatch {
+  public:
+  string table;
+  uint32_t rowCount;
+  vector<string> fields;
+  vector<int> types;
+  vector<vector<GenericValueContainer>> columns;
+
+  InsertBatch(): rowCount(0) {}
+
+  // compact binary form used by the write ahead log
+  void encode(string &out) const;
+
+  // returns false when data is not a valid encoded batch
+  bool decode(const char *data, size_t size);
+
+  // appends rows to the table. nothing is applied when the
+  // fields of the table do not match the batch anymore.
+  bool apply(Table *table, string &err) const;
+};
+
+#endif //MERLIN_INSERT_BATCH_H
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include "packed-column.h"
+#include "simd.h"
+
+using namespace std;
+
+// widest frame of reference width, wider blocks are stored raw.
+// a value must be readable with one unaligned 8 byte load.
+static const int MAX_PACKED_WIDTH = 56;
+
+PackedColumn::PackedColumn(const PackedColumn &other): count(other.count), blocks(other.blocks), tail(other.tail) {
+  for (auto &&block : blocks) {
+    if (!block.owned.empty()) {
+      block.data = block.owned.data();
+    }
+  }
+}
+
+void PackedColumn::push_back(int64_t value) {
+  // tail keeps its capacity after sealing,
+  // so only the first block grows by reallocation
+  if (tail.empty() && blocks.empty()) {
+    tail.push_back(value);
+  }
+
+  tail.push_back(value);
+  count++;
+
+  if (tail.size() == BLOCK_ROWS) {
+    seal();
+  }
+}
+
+void PackedColumn::seal() {
+  Block block;
+  const auto minmax = std::minmax_element(tail.begin(), tail.end());
+  const uint64_t spread = (uint64_t) *minmax.second - (uint64_t) *minmax.first;
+
+  block.base = *minmax.first;
+  block.width = spread == 0 ? 0 : 64 - __builtin_clzll(spread);
+
+  if (block.width > MAX_PACKED_WIDTH) {
+    block.base = 0;
+    block.width = 64;
+    block.owned.resize(tail.size() * sizeof(int64_t));
+    memcpy(block.owned.data(), tail.data(), block.owned.size());
+  } else {
+    // 8 bytes of padding for the unaligned loads of the last values
+    block.owned.assign(((uint64_t) tail.size() * block.width + 7) / 8 + sizeof(uint64_t), 0);
+
+    for (uint64_t i = 0, bit = 0; i < tail.size(); i++, bit += block.width) {
+      const uint64_t value = (uint64_t) tail[i] - (uint64_t) block.base;
+      uint64_t word;
+      memcpy(&word, block.owned.data() + (bit >> 3), sizeof(word));
+      word |= value << (bit & 7);
+      memcpy(block.owned.data() + (bit >> 3), &word, sizeof(word));
+    }
+  }
+
+  block.data = block.owned.data();
+  block.dataSize = block.owned.size();
+
+  blocks.push_back(std::move(block));
+  tail.clear();
+}
+
+void PackedColumn::gather(const uint32_t *rowIds, size_t n, int64_t *out) const {
+  size_t i = 0;
+
+  while (i < n) {
+    // decode the run of rows falling into the same block at once
+    const size_t block = rowIds[i] / BLOCK_ROWS;
+    size_t end = i + 1;
+
+    while (end < n && rowIds[end] / BLOCK_ROWS == block) {
+      end++;
+    }
+
+    if (block == blocks.size()) {
+      for (; i < end; i++) {
+        out[i] = tail[rowIds[i] % BLOCK_ROWS];
+      }
+      continue;
+    }
+
+    const auto &sealed = blocks[block];
+
+    if (sealed.width == 64) {
+      for (; i < end; i++) {
+        out[i] = (*this)[rowIds[i] - 1];
+      }
+      continue;
+    }
+
+    simdUnpackGather(sealed.data, sealed.width, sealed.base, rowIds + i, BLOCK_ROWS - 1, end - i, out + i);
+    i = end;
+  }
+}
+
+int64_t PackedColumn::statUsedMemory() const {
+  int64_t sum = sizeof(int64_t) * tail.capacity() + sizeof(Block) * blocks.capacity();
+
+  for (auto &&block : blocks) {
+    sum += block.owned.capacity();
+  }
+
+  return sum;
+}
+
+void PackedColumn::save(SnapshotWriter &writer) const {
+  writer.writeValue((uint64_t) count);
+  writer.writeValue((uint64_t) blocks.size());
+
+  for (auto &&block : blocks) {
+    writer.writeValue(block.base);
+    writer.writeValue(block.width);
+    writer.writeArray(block.data, block.dataSize);
+  }
+
+  writer.writeVector(tail);
+}
+
+void PackedColumn::load(SnapshotReader &reader) {
+  count = reader.readValue<uint64_t>();
+  blocks.resize(reader.readValue<uint64_t>());
+
+  for (auto &&block : blocks) {
+    block.base = reader.readValue<int64_t>();
+    block.width = reader.readValue<int>();
+
+    if (reader.isZeroCopy()) {
+      block.data = reader.viewArray<uint8_t>(&block.dataSize);
+    } else {
+      reader.readVector(block.owned);
+      block.data = block.owned.data();
+      block.dataSize = block.owned.size();
+    }
+  }
+
+  reader.readVector(tail);
+}
@@ -0,0 +1,97 @@
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include "snapshot.h"
+
+#ifndef MERLIN_PACKED_COLUMN_H
+#define MERLIN_PACKED_COLUMN_H
+
+using namespace std;
+
+// append only integer column.
+// rows are grouped into blocks of 2^16 row ids, the same ranges roaring
+// uses for its containers, so rows of one container are decoded from one block.
+// the block being filled is kept raw. once full it is sealed:
+// values are stored as offsets from the block minimum (frame of reference),
+// bit packed with the smallest width that fits them.
+class PackedColumn {
+  public:
+  static const uint32_t BLOCK_ROWS = 1 << 16;
+
+  PackedColumn(): count(0) {}
+
+  // owned blocks of the copy point into its own data, mapped ones into the same mapping
+  PackedColumn(const PackedColumn &other);
+  PackedColumn &operator=(const PackedColumn &) = delete;
+
+  size_t size() const {
+    return count;
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  void push_back(int64_t value);
+
+  // value of row at given index, row id is index + 1
+  int64_t operator[](size_t index) const {
+    const uint32_t rowId = (uint32_t) index + 1;
+    const size_t block = rowId / BLOCK_ROWS;
+    const uint32_t position = rowId % BLOCK_ROWS;
+
+    if (block == blocks.size()) {
+      return tail[position];
+    }
+
+    const auto &sealed = blocks[block];
+
+    if (sealed.width == 64) {
+      int64_t value;
+      memcpy(&value, sealed.data + position * sizeof(int64_t), sizeof(value));
+      return value;
+    }
+
+    const uint64_t bit = (uint64_t) position * sealed.width;
+    uint64_t word;
+    memcpy(&word, sealed.data + (bit >> 3), sizeof(word));
+    return sealed.base + (int64_t) ((word >> (bit & 7)) & ((1ULL << sealed.width) - 1));
+  }
+
+  // values of given row ids (1 based) into out
+  void gather(const uint32_t *rowIds, size_t n, int64_t *out) const;
+
+  // memory owned by the column, mapped blocks excluded
+  int64_t statUsedMemory() const;
+
+  // releases unused capacity
+  void shrinkToFit() {
+    tail.shrink_to_fit();
+    blocks.shrink_to_fit();
+  }
+
+  void save(SnapshotWriter &writer) const;
+  // in zero copy mode sealed blocks are used from the mapping in place
+  void load(SnapshotReader &reader);
+
+  private:
+  struct Block {
+    int64_t base;
+    // bits per value, 64 means values are stored raw
+    int width;
+    // points either into owned or into a mapped snapshot file
+    const uint8_t *data;
+    uint64_t dataSize;
+    vector<uint8_t> owned;
+  };
+
+  size_t count;
+  vector<Block> blocks;
+  // values of the block being filled, indexed by row id % BLOCK_ROWS.
+  // row id 0 is never used, first block starts with a placeholder.
+  vector<int64_t> tail;
+
+  void seal();
+};
+
+#endif //MERLIN_PACKED_COLUMN_H
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <math.h>
+#include "quantile-sketch.h"
+
+using namespace std;
+
+static const uint64_t SUB_BUCKETS = 1 << QUANTILE_SUB_BITS;
+
+// magnitudes below SUB_BUCKETS get a bucket each, larger ones share
+// SUB_BUCKETS buckets per power of two
+static inline int32_t bucketIndex(uint64_t magnitude) {
+  if (magnitude < SUB_BUCKETS) {
+    return (int32_t) magnitude;
+  }
+
+  const int exponent = 63 - __builtin_clzll(magnitude);
+  const int shift = exponent - QUANTILE_SUB_BITS;
+  return (int32_t) ((shift + 1) * SUB_BUCKETS + ((magnitude >> shift) - SUB_BUCKETS));
+}
+
+// middle of the magnitudes a bucket holds
+static inline uint64_t bucketValue(int32_t index) {
+  if (index < (int32_t) SUB_BUCKETS) {
+    return (uint64_t) index;
+  }
+
+  const int shift = index / SUB_BUCKETS - 1;
+  const uint64_t low = (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+  return low + ((1ULL << shift) - 1) / 2;
+}
+
+void QuantileBuckets::add(int32_t index, uint64_t count) {
+  if (counts.empty()) {
+    offset = index;
+  }
+
+  if (index < offset) {
+    counts.insert(counts.begin(), offset - index, 0);
+    offset = index;
+  }
+
+  if (index - offset >= (int32_t) counts.size()) {
+    counts.resize(index - offset + 1, 0);
+  }
+
+  counts[index - offset] += count;
+}
+
+void QuantileBuckets::merge(const QuantileBuckets &other) {
+  for (size_t i = 0; i < other.counts.size(); i++) {
+    if (other.counts[i] > 0) {
+      add(other.offset + (int32_t) i, other.counts[i]);
+    }
+  }
+}
+
+void QuantileSketch::addToBuckets(int64_t value, uint64_t n) {
+  if (value < 0) {
+    negative.add(bucketIndex(0 - (uint64_t) value), n);
+  } else {
+    positive.add(bucketIndex((uint64_t) value), n);
+  }
+}
+
+void QuantileSketch::toBuckets() {
+  if (bucketed) {
+    return;
+  }
+
+  bucketed = true;
+
+  for (auto &&value : values) {
+    addToBuckets(value, 1);
+  }
+
+  vector<int64_t>().swap(values);
+}
+
+void QuantileSketch::merge(const QuantileSketch &other) {
+  if (!other.bucketed) {
+    for (auto &&value : other.values) {
+      add(value);
+    }
+    return;
+  }
+
+  toBuckets();
+  count += other.count;
+  positive.merge(other.positive);
+  negative.merge(other.negative);
+}
+
+int64_t QuantileSketch::percentile(double p) {
+  if (count == 0) {
+    return 0;
+  }
+
+  const uint64_t rank = std::max((uint64_t) 1, std::min(count, (uint64_t) ceil(p / 100 * count)));
+
+  if (!bucketed) {
+    std::nth_element(values.begin(), values.begin() + (rank - 1), values.end());
+    return values[rank - 1];
+  }
+
+  uint64_t seen = 0;
+
+  // most negative values are in the last negative buckets
+  for (size_t i = negative.counts.size(); i-- > 0; ) {
+    seen += negative.counts[i];
+    if (seen >= rank) {
+      return (int64_t) (0 - bucketValue(negative.offset + (int32_t) i));
+    }
+  }
+
+  for (size_t i = 0; i < positive.counts.size(); i++) {
+    seen += positive.counts[i];
+    if (seen >= rank) {
+      return (int64_t) bucketValue(positive.offset + (int32_t) i);
+    }
+  }
+
+  return 0;
+}
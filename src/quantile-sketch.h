@@ -0,0 +1,66 @@
+#include <vector>
+#include <stdint.h>
+
+#ifndef MERLIN_QUANTILE_SKETCH_H
+#define MERLIN_QUANTILE_SKETCH_H
+
+using namespace std;
+
+// groups up to this many values keep them as they are and answer exactly
+const size_t QUANTILE_EXACT_VALUES = 256;
+// larger ones count values in log-linear buckets of 2^QUANTILE_SUB_BITS
+// sub-buckets per power of two, so estimates are within 1/64 of the value
+const int QUANTILE_SUB_BITS = 6;
+
+// row counts of a contiguous range of bucket indexes
+class QuantileBuckets {
+  public:
+  int32_t offset = 0;
+  vector<uint64_t> counts;
+
+  void add(int32_t index, uint64_t count);
+  void merge(const QuantileBuckets &other);
+};
+
+// mergeable percentiles of int values.
+// memory is bounded by the bucket count of the value range,
+// at most 59 * 2^QUANTILE_SUB_BITS buckets for each sign.
+class QuantileSketch {
+  public:
+  uint64_t count = 0;
+  // values while the sketch is exact
+  vector<int64_t> values;
+  bool bucketed = false;
+  // buckets of magnitudes of positive and zero, and of negative values
+  QuantileBuckets positive;
+  QuantileBuckets negative;
+
+  void add(int64_t value) {
+    count++;
+
+    if (!bucketed) {
+      values.push_back(value);
+      if (values.size() > QUANTILE_EXACT_VALUES) {
+        toBuckets();
+      }
+      return;
+    }
+
+    addToBuckets(value, 1);
+  }
+
+  void merge(const QuantileSketch &other);
+
+  // nearest rank percentile, p in [0, 100]. reorders values of exact sketches.
+  int64_t percentile(double p);
+
+  int64_t statUsedMemory() const {
+    return sizeof(int64_t) * values.capacity() + sizeof(uint64_t) * (positive.counts.capacity() + negative.counts.capacity());
+  }
+
+  private:
+  void toBuckets();
+  void addToBuckets(int64_t value, uint64_t n);
+};
+
+#endif //MERLIN_QUANTILE_SKETCH_H
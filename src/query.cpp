@@ -1,40 +1,227 @@
 #include <iostream>
 #include <algorithm>
 #include <chrono>
+#include <unordered_map>
 #include "query.h"
+#include "thread-pool.h"
 #include "utils.h"
 
 using namespace std;
 
-void Query::applyFilters() {
-  auto result = initialBitmap;
+// group by planning assumes a bitmap AND costs about as much as
+// looking at this many rows while scanning
+static const double ROWS_PER_BITMAP_AND = 256;
 
-  for (auto &&filter : filterExprs) {
-    if (debug) {
-      cout << filter->field << " " << filter->op << " " << filter->val << endl;
-    }
-    auto bitmap = table->fields[filter->field]->getBitmap(filter->op, filter->val);
-    if (bitmap == nullptr) {
-      // this means no results found for this bitmap.
-      // while we always doing AND on result bitmaps,
-      // we could get empty bitmap
-      // so I am resetting result bitmap and stopping loop
-      roaring_bitmap_clear(result);
+// relative cost of looking a filter up: bitmap lookups are cheap,
+// indexes cost more and filters without one scan the whole column
+double Query::estimateFilterCost(FilterExpr *filter) {
+  if (!filter->isLeaf()) {
+    double cost = 1;
+
+    for (auto &&child : filter->children) {
+      cost += estimateFilterCost(child);
+    }
+
+    return cost;
+  }
+
+  if (segment->fields.count(filter->field) == 0) {
+    return 0;
+  }
+
+  const auto field = segment->fields[filter->field];
+  const double valueCount = std::max((size_t) 1, filter->values.size());
+  double cost;
+
+  if (field->type == FIELD_TYPE_BOOLEAN || (field->type == FIELD_TYPE_STRING && field->encoding != FIELD_ENCODING_NONE)) {
+    cost = 1;
+  } else if (field->type == FIELD_TYPE_TIMESTAMP) {
+    cost = 2;
+  } else if (field->type == FIELD_TYPE_INT && field->encoding == FIELD_ENCODING_BSI) {
+    cost = 4;
+  } else {
+    cost = 16;
+  }
+
+  // "!=" builds the full range and removes matching rows
+  return cost * valueCount + (filter->op == "!=" ? 1 : 0);
+}
+
+// looks filters up, cheapest first, until one matches no rows
+void Query::lookupFilterBitmaps(const vector<FilterExpr *> &filters, vector<FilterBitmap> &bitmaps, bool &empty) {
+  vector<pair<double, FilterExpr *>> ordered;
+
+  for (auto &&filter : filters) {
+    ordered.push_back(make_pair(estimateFilterCost(filter), filter));
+  }
+
+  std::stable_sort(ordered.begin(), ordered.end(), [](const pair<double, FilterExpr *> &a, const pair<double, FilterExpr *> &b) {
+    return a.first < b.first;
+  });
+
+  for (auto &&it : ordered) {
+    const auto filter = it.second;
+    FilterBitmap entry;
+    entry.filter = filter;
+    entry.bitmap = evaluateFilter(filter, entry.owned);
+
+    if (entry.bitmap == nullptr) {
+      // value does not exist in this segment
+      empty = true;
       break;
     }
 
+    entry.cardinality = roaring_bitmap_get_cardinality(entry.bitmap);
+    bitmaps.push_back(entry);
+
     if (debug) {
-      cout << "field's bitmap's cardinality: " << roaring_bitmap_get_cardinality(bitmap) << endl;
+      cout << (filter->isLeaf() ? filter->field + " " + filter->op + " " + filter->val : filter->op) << ", cardinality: " << entry.cardinality << endl;
     }
 
-    roaring_bitmap_and_inplace(result, bitmap);
+    if (entry.cardinality == 0) {
+      empty = true;
+      break;
+    }
+  }
+}
 
-    if (debug) {
-      cout << "current bitmap's cardinality: " << roaring_bitmap_get_cardinality(result) << endl;
+static void freeFilterBitmaps(const vector<FilterBitmap> &bitmaps) {
+  for (auto &&entry : bitmaps) {
+    if (entry.owned) {
+      roaring_bitmap_free(entry.bitmap);
     }
   }
 }
 
+roaring_bitmap_t *Query::intersectFilters(const vector<FilterExpr *> &filters) {
+  vector<FilterBitmap> bitmaps;
+  bool empty = false;
+  roaring_bitmap_t *result;
+
+  // every filter is looked up first, so intersections can start from
+  // the most selective one instead of the whole segment
+  try {
+    lookupFilterBitmaps(filters, bitmaps, empty);
+  } catch (...) {
+    freeFilterBitmaps(bitmaps);
+    throw;
+  }
+
+  std::sort(bitmaps.begin(), bitmaps.end(), [](const FilterBitmap &a, const FilterBitmap &b) {
+    return a.cardinality < b.cardinality;
+  });
+
+  if (empty) {
+    result = roaring_bitmap_create();
+  } else if (bitmaps.empty()) {
+    result = roaring_bitmap_from_range(1, segment->size + 1, 1);
+  } else {
+    // in place ANDs on a copy of the smallest bitmap, in increasing
+    // cardinality order, so every step works on the least rows possible
+    result = bitmaps[0].owned ? bitmaps[0].bitmap : roaring_bitmap_copy(bitmaps[0].bitmap);
+    bitmaps[0].owned = false;
+
+    for (size_t i = 1; i < bitmaps.size() && !roaring_bitmap_is_empty(result); i++) {
+      roaring_bitmap_and_inplace(result, bitmaps[i].bitmap);
+
+      if (debug) {
+        cout << "and, cardinality: " << roaring_bitmap_get_cardinality(result) << endl;
+      }
+    }
+  }
+
+  freeFilterBitmaps(bitmaps);
+
+  return result;
+}
+
+roaring_bitmap_t *Query::unionFilters(const vector<FilterExpr *> &filters) {
+  vector<FilterBitmap> bitmaps;
+  vector<const roaring_bitmap_t *> operands;
+  roaring_bitmap_t *result = nullptr;
+
+  try {
+    for (auto &&filter : filters) {
+      FilterBitmap entry;
+      entry.filter = filter;
+      entry.bitmap = evaluateFilter(filter, entry.owned);
+
+      if (entry.bitmap == nullptr) {
+        continue;
+      }
+
+      bitmaps.push_back(entry);
+      operands.push_back(entry.bitmap);
+
+      // nothing can be added to a child matching every row
+      if (roaring_bitmap_get_cardinality(entry.bitmap) == segment->size) {
+        result = roaring_bitmap_copy(entry.bitmap);
+        break;
+      }
+    }
+  } catch (...) {
+    freeFilterBitmaps(bitmaps);
+    throw;
+  }
+
+  if (result == nullptr) {
+    // a single heap based union of every child
+    result = operands.empty() ? roaring_bitmap_create() : roaring_bitmap_or_many(operands.size(), operands.data());
+  }
+
+  freeFilterBitmaps(bitmaps);
+
+  if (debug) {
+    cout << "or, cardinality: " << roaring_bitmap_get_cardinality(result) << endl;
+  }
+
+  return result;
+}
+
+roaring_bitmap_t *Query::evaluateFilter(FilterExpr *filter, bool &owned) {
+  if (filter->isLeaf()) {
+    if (segment->fields.count(filter->field) == 0) {
+      throw std::runtime_error("unknown field in filters: " + filter->field);
+    }
+
+    return filter->values.empty()
+           ? segment->fields[filter->field]->getBitmap(filter->op, filter->val, owned)
+           : segment->fields[filter->field]->getBitmap(filter->op, filter->values, owned);
+  }
+
+  owned = true;
+
+  if (filter->op == "and") {
+    return intersectFilters(filter->children);
+  }
+
+  if (filter->op == "or") {
+    return unionFilters(filter->children);
+  }
+
+  if (filter->op == "not" && filter->children.size() == 1) {
+    bool childOwned;
+    const auto child = evaluateFilter(filter->children[0], childOwned);
+    // every row of the segment exists, so its range is the existence bitmap
+    auto result = roaring_bitmap_from_range(1, segment->size + 1, 1);
+
+    if (child != nullptr) {
+      roaring_bitmap_andnot_inplace(result, child);
+      if (childOwned) {
+        roaring_bitmap_free(child);
+      }
+    }
+
+    return result;
+  }
+
+  throw std::runtime_error("invalid filter expression: " + filter->op);
+}
+
+void Query::applyFilters() {
+  initialBitmap = intersectFilters(filterExprs);
+}
+
 SelectExpr *Query::findSelectExprByDisplayValue(string displayValue) {
   for (auto &&selectExpr : selectExprs) {
     if (selectExpr->display == displayValue) {
@@ -51,17 +238,181 @@ static void clearAggrGroups(vector<AggregationGroup *> groups) {
   }
 }
 
+void Query::resolveGroupBy(GroupByExpr *groupByExpr, Field **field, SelectExpr **aggrSelectExpr) {
+  // group by expressions either name a field or
+  // the display value of an aggregation select such as dateSecondsGroup
+  if (segment->fields.count(groupByExpr->field) == 1) {
+    *field = segment->fields[groupByExpr->field];
+    *aggrSelectExpr = nullptr;
+    return;
+  }
+
+  *aggrSelectExpr = findSelectExprByDisplayValue(groupByExpr->field);
+
+  if (*aggrSelectExpr == nullptr || segment->fields.count((*aggrSelectExpr)->field) == 0) {
+    throw std::runtime_error("unknown field in group by: " + groupByExpr->field);
+  }
+
+  *field = segment->fields[(*aggrSelectExpr)->field];
+}
+
+bool Query::shouldGroupByScan() {
+  const double rows = roaring_bitmap_get_cardinality(initialBitmap);
+  double parentGroups = 1;
+  double andCount = 0;
+
+  if (groupByExprs.empty() || rows == 0) {
+    return false;
+  }
+
+  // bitmap grouping costs one AND per (parent group, value) pair,
+  // scanning costs a pass over filtered rows.
+  for (auto &&groupByExpr : groupByExprs) {
+    Field *field;
+    SelectExpr *aggrSelectExpr;
+    resolveGroupBy(groupByExpr, &field, &aggrSelectExpr);
+
+    if (aggrSelectExpr != nullptr) {
+      if (aggrSelectExpr->aggerationFunc != "dateSecondsGroup" || field->type != FIELD_TYPE_TIMESTAMP) {
+        return false;
+      }
+    } else if (field->type != FIELD_TYPE_STRING || field->encoding != FIELD_ENCODING_DICT || !field->storage.strval.dict.hasRowIds) {
+      return false;
+    }
+
+    const double distinct = field->estimateDistinctCount(aggrSelectExpr != nullptr ? aggrSelectExpr->aggerationFuncArgs : vector<string>());
+    andCount += parentGroups * distinct;
+    parentGroups = std::min(parentGroups * distinct, rows);
+  }
+
+  return andCount * ROWS_PER_BITMAP_AND > rows;
+}
+
+void Query::genAggrGroupsScan() {
+  const auto rowCount = (size_t) roaring_bitmap_get_cardinality(initialBitmap);
+  vector<uint32_t> rows(rowCount);
+  // group of each row, refined by every group by expression
+  vector<uint32_t> rowGroups(rowCount, 0);
+  // for every level: parent group and value of each group
+  vector<vector<uint32_t>> groupParents;
+  vector<vector<uint32_t>> groupValues;
+  // bucket starts of dateSecondsGroup levels, indexed by value
+  vector<vector<int64_t>> levelBuckets;
+  vector<Field *> levelFields;
+
+  roaring_bitmap_to_uint32_array(initialBitmap, rows.data());
+
+  for (auto &&groupByExpr : groupByExprs) {
+    Field *field;
+    SelectExpr *aggrSelectExpr;
+    resolveGroupBy(groupByExpr, &field, &aggrSelectExpr);
+
+    // (parent group << 32 | value) > group
+    unordered_map<uint64_t, uint32_t> groupIds;
+    vector<uint32_t> parents;
+    vector<uint32_t> values;
+    vector<int64_t> buckets;
+
+    if (aggrSelectExpr != nullptr) {
+      const int64_t secs = strtoll(aggrSelectExpr->aggerationFuncArgs.empty() ? "0" : aggrSelectExpr->aggerationFuncArgs[0].c_str(), nullptr, 10);
+      unordered_map<int64_t, uint32_t> bucketIds;
+
+      if (secs <= 0) {
+        throw std::runtime_error("dateSecondsGroup: invalid bucket width");
+      }
+
+      vector<int64_t> timestamps(rowCount);
+      field->storage.timestamps.gather(rows.data(), rowCount, timestamps.data());
+
+      for (size_t i = 0; i < rowCount; i++) {
+        const auto timestamp = timestamps[i];
+        const int64_t bucket = timeBucketStart(timestamp, secs);
+        const auto inserted = bucketIds.emplace(bucket, (uint32_t) buckets.size());
+        if (inserted.second) {
+          buckets.push_back(bucket);
+        }
+
+        const uint64_t key = ((uint64_t) rowGroups[i] << 32) | inserted.first->second;
+        const auto group = groupIds.emplace(key, (uint32_t) parents.size());
+        if (group.second) {
+          parents.push_back(rowGroups[i]);
+          values.push_back(inserted.first->second);
+        }
+        rowGroups[i] = group.first->second;
+      }
+    } else {
+      const auto &rowIds = field->storage.strval.dict.rowIds;
+
+      for (size_t i = 0; i < rowCount; i++) {
+        const uint32_t id = rowIds[rows[i] - 1];
+        const uint64_t key = ((uint64_t) rowGroups[i] << 32) | id;
+        const auto group = groupIds.emplace(key, (uint32_t) parents.size());
+        if (group.second) {
+          parents.push_back(rowGroups[i]);
+          values.push_back(id);
+        }
+        rowGroups[i] = group.first->second;
+      }
+    }
+
+    groupParents.push_back(std::move(parents));
+    groupValues.push_back(std::move(values));
+    levelBuckets.push_back(std::move(buckets));
+    levelFields.push_back(field);
+  }
+
+  const auto levels = groupParents.size();
+  const auto groupCount = groupParents[levels - 1].size();
+  vector<vector<uint32_t>> members(groupCount);
+
+  // rows are visited in increasing order, so members are sorted too
+  for (size_t i = 0; i < rowCount; i++) {
+    members[rowGroups[i]].push_back(rows[i]);
+  }
+
+  for (uint32_t group = 0; group < groupCount; group++) {
+    vector<string> keys(levels);
+    map<string, string> valueMap;
+
+    for (size_t level = levels, current = group; level-- > 0; current = groupParents[level][current]) {
+      const auto field = levelFields[level];
+      const auto value = groupValues[level][current];
+      keys[level] = field->type == FIELD_TYPE_TIMESTAMP
+                    ? to_string(levelBuckets[level][value])
+                    : field->storage.strval.dict.dict.str(value);
+      valueMap[field->name] = keys[level];
+    }
+
+    auto bitmap = roaring_bitmap_create();
+    roaring_bitmap_add_many(bitmap, members[group].size(), members[group].data());
+    aggregationGroups.push_back(new AggregationGroup(keys, valueMap, bitmap));
+
+    if (debug) {
+      cout << "generated keys: ";
+      dumpStrVector(keys);
+      cout << " | bitmap size: " << members[group].size() << endl;
+    }
+  }
+}
+
 void Query::genAggrGroups() {
-  bool noFilter = filterExprs.size() == 0;
+  if (shouldGroupByScan()) {
+    if (debug) {
+      cout << "group by: scanning filtered rows" << endl;
+    }
+    genAggrGroupsScan();
+    return;
+  }
+
+  // fields group all of their rows faster than a bitmap of them
+  bool noFilter = roaring_bitmap_get_cardinality(initialBitmap) == segment->size;
   vector<AggregationGroup *> result;
   for (auto &&groupByExpr : groupByExprs) {
-    const auto isAggerationGroupBy = table->fields.count(groupByExpr->field) == 0;
-    const auto aggrSelectExpr = findSelectExprByDisplayValue(groupByExpr->field);
-    const auto field = isAggerationGroupBy
-                       ? table->fields[aggrSelectExpr->field]
-                       : table->fields[groupByExpr->field];
+    Field *field;
+    SelectExpr *aggrSelectExpr;
+    resolveGroupBy(groupByExpr, &field, &aggrSelectExpr);
+    const auto isAggerationGroupBy = aggrSelectExpr != nullptr;
 
-    // const auto keys = field->keys();
     if (result.size() == 0) {
       vector<AggregationGroup *> aggrGroupsField;
       const auto groups = isAggerationGroupBy
@@ -78,12 +429,8 @@ void Query::genAggrGroups() {
       }
       result = aggrGroupsField;
 
-      if (isAggerationGroupBy) {
-        aggrSelectExpr->groups = std::move(groups);
-      } else {
-        for (auto &&group : groups) {
-          roaring_bitmap_free(group.second);
-        }
+      for (auto &&group : groups) {
+        roaring_bitmap_free(group.second);
       }
       continue;
     }
@@ -96,31 +443,25 @@ void Query::genAggrGroups() {
         cout << endl;
       }
 
-      for (unsigned long i = 0, size = groupByGroup->keys.size(); i < size; ++i) {
-        const auto currentBitmap = groupByGroup->bitmap;
-        const auto groups = isAggerationGroupBy
-                            ? field->genGroups(currentBitmap, aggrSelectExpr->aggerationFunc, aggrSelectExpr->aggerationFuncArgs)
-                            : field->genGroups(currentBitmap);
-        for (auto &&group : groups) {
-          const auto aggregationGroup = groupByGroup->clone(field->name, group.first, group.second);
-          aggrGroupsField.push_back(aggregationGroup);
-
-          if (debug) {
-            cout << "generated group for... " << group.first << endl;
-            cout << "generated keys: ";
-            dumpStrVector(aggregationGroup->keys);
-            cout << " | bitmap size: " << roaring_bitmap_get_cardinality(aggregationGroup->bitmap) << endl;
-          }
-        }
+      const auto currentBitmap = groupByGroup->bitmap;
+      const auto groups = isAggerationGroupBy
+                          ? field->genGroups(currentBitmap, aggrSelectExpr->aggerationFunc, aggrSelectExpr->aggerationFuncArgs)
+                          : field->genGroups(currentBitmap);
+      for (auto &&group : groups) {
+        const auto aggregationGroup = groupByGroup->clone(field->name, group.first, group.second);
+        aggrGroupsField.push_back(aggregationGroup);
 
-        if (isAggerationGroupBy) {
-          aggrSelectExpr->groups = std::move(groups);
-        } else {
-          for (auto &&it : groups) {
-            delete it.second;
-          }
+        if (debug) {
+          cout << "generated group for... " << group.first << endl;
+          cout << "generated keys: ";
+          dumpStrVector(aggregationGroup->keys);
+          cout << " | bitmap size: " << roaring_bitmap_get_cardinality(aggregationGroup->bitmap) << endl;
         }
       }
+
+      for (auto &&it : groups) {
+        roaring_bitmap_free(it.second);
+      }
     }
 
     clearAggrGroups(result);
@@ -130,68 +471,512 @@ void Query::genAggrGroups() {
   aggregationGroups = result;
 }
 
-void Query::genResultRows() {
+// key of a group in partialIndex, keys are length prefixed
+static string joinGroupKeys(const vector<string> &keys) {
+  string joined;
+
+  for (auto &&key : keys) {
+    joined += to_string(key.size());
+    joined += ':';
+    joined += key;
+  }
+
+  return joined;
+}
+
+PartialAggregate *Query::findPartial(const vector<string> &keys, bool &first) {
+  const auto inserted = partialIndex.emplace(joinGroupKeys(keys), partialAggregates.size());
+  first = inserted.second;
+
+  if (first) {
+    auto partial = new PartialAggregate();
+    partial->keys = keys;
+    partial->count = 0;
+    partial->values.resize(selectExprs.size(), 0);
+    partial->distinctStrings.resize(selectExprs.size());
+    partial->distinctInts.resize(selectExprs.size());
+    partial->sketches.resize(selectExprs.size());
+    partial->quantiles.resize(selectExprs.size());
+    partial->histograms.resize(selectExprs.size());
+    for (size_t i = 0; i < selectExprs.size(); i++) {
+      if (aggregations[i].func == AGGR_FUNC_HISTOGRAM) {
+        partial->histograms[i].resize(aggregations[i].histogramBounds.size() + 1, 0);
+      }
+    }
+    partialAggregates.push_back(partial);
+  }
+
+  return partialAggregates[inserted.first->second];
+}
+
+// folds an aggregate of some rows into the one of a group,
+// int and timestamp fields return their values sign extended
+static void mergeAggregate(int func, bool isSigned, bool first, uint64_t value, uint64_t &merged) {
+  if (func == AGGR_FUNC_MIN) {
+    const bool less = isSigned ? (int64_t) value < (int64_t) merged : value < merged;
+    merged = first || less ? value : merged;
+  } else if (func == AGGR_FUNC_MAX) {
+    const bool greater = isSigned ? (int64_t) value > (int64_t) merged : value > merged;
+    merged = first || greater ? value : merged;
+  } else {
+    merged += value;
+  }
+}
+
+void Query::mergeAggrGroups() {
   if (!isAggregationQuery) {
     throw std::runtime_error("non aggregation queries are not supported at the moment");
   }
 
   for (auto &&aggrGroup : aggregationGroups) {
-    auto row = new QueryResultRow();
+    const auto count = roaring_bitmap_get_cardinality(aggrGroup->bitmap);
+    bool first;
+    auto partial = findPartial(aggrGroup->keys, first);
 
-    for (auto &&selectExpr : selectExprs) {
-      if (selectExpr->isAggerationSelect) {
-        if (selectExpr->aggerationFunc == "count") {
-          if (selectExpr->field != "*") {
-            throw std::runtime_error("only '*' is supported for count()");
-          }
+    if (first) {
+      partial->valueMap = aggrGroup->valueMap;
+    }
 
-          if (debug) {
-            cout << "[" << roaring_bitmap_get_cardinality(aggrGroup->bitmap) << "] ";
-          }
-          row->values.push_back(new GenericValueContainer(roaring_bitmap_get_cardinality(aggrGroup->bitmap)));
-        } else if (selectExpr->aggerationFunc == "min") {
-          const auto field = table->fields[selectExpr->field];
-          const auto min = field->aggrFuncMin(aggrGroup->bitmap);
-          if (debug) {
-            cout << "[" << min << "] ";
-          }
-          row->values.push_back(new GenericValueContainer(min));
-        } else if (selectExpr->aggerationFunc == "max") {
-          const auto field = table->fields[selectExpr->field];
-          const auto max = field->aggrFuncMax(aggrGroup->bitmap);
-          if (debug) {
-            cout << "[" << max << "] ";
-          }
-          row->values.push_back(new GenericValueContainer(max));
-        } else if (selectExpr->aggerationFunc == "sum") {
-          const auto field = table->fields[selectExpr->field];
-          const auto sum = field->aggrFuncSum(aggrGroup->bitmap);
-          if (debug) {
-            cout << "[" << sum << "] ";
-          }
-          row->values.push_back(new GenericValueContainer(sum));
-        } else if (selectExpr->aggerationFunc == "avg" || selectExpr->aggerationFunc == "mean") {
-          const auto field = table->fields[selectExpr->field];
-          const auto sum = field->aggrFuncSum(aggrGroup->bitmap);
-          const auto avg = sum / roaring_bitmap_get_cardinality(aggrGroup->bitmap);
-          if (debug) {
-            cout << "[" << avg << "] ";
-          }
-          row->values.push_back(new GenericValueContainer(avg));
-        } else if (selectExpr->aggerationFunc == "dateSecondsGroup") {
-          if (debug) {
-            cout << "[" << aggrGroup->valueMap[selectExpr->field] << "] ";
+    partial->count += count;
+
+    for (auto &&plan : fieldAggregations) {
+      const auto field = segment->fields[plan.field];
+      FieldAggregate aggregate = {0, 0, 0};
+
+      if (plan.readsValues) {
+        plan.kernel(field, aggrGroup->bitmap, aggregate, [&](const int64_t *values, uint32_t n) {
+          for (auto &&i : plan.selects) {
+            if (aggregations[i].func == AGGR_FUNC_PERCENTILE) {
+              auto &quantile = partial->quantiles[i];
+              for (uint32_t j = 0; j < n; j++) {
+                quantile.add(values[j]);
+              }
+            } else if (aggregations[i].func == AGGR_FUNC_HISTOGRAM) {
+              const auto &bounds = aggregations[i].histogramBounds;
+              auto &counts = partial->histograms[i];
+              for (uint32_t j = 0; j < n; j++) {
+                counts[std::upper_bound(bounds.begin(), bounds.end(), values[j]) - bounds.begin()]++;
+              }
+            }
           }
-          row->values.push_back(new GenericValueContainer(aggrGroup->valueMap[selectExpr->field]));
-        } else {
-          throw std::runtime_error("unknown aggregation function: " + selectExpr->aggerationFunc + " -- " + (selectExpr->aggerationFunc == "count" ? "true" : "false"));
+        });
+      } else {
+        plan.kernel(field, aggrGroup->bitmap, aggregate, nullptr);
+      }
+
+      for (auto &&i : plan.selects) {
+        const auto &aggregation = aggregations[i];
+
+        switch (aggregation.func) {
+          case AGGR_FUNC_MIN: {
+            mergeAggregate(aggregation.func, aggregation.isSigned, first, aggregate.min, partial->values[i]);
+          } break;
+          case AGGR_FUNC_MAX: {
+            mergeAggregate(aggregation.func, aggregation.isSigned, first, aggregate.max, partial->values[i]);
+          } break;
+          case AGGR_FUNC_SUM:
+          case AGGR_FUNC_AVG: {
+            mergeAggregate(aggregation.func, aggregation.isSigned, first, aggregate.sum, partial->values[i]);
+          } break;
         }
+      }
+    }
+
+    // dictionaries differ between segments, so values are collected as strings
+    for (size_t i = 0; i < selectExprs.size(); i++) {
+      const auto func = aggregations[i].func;
+
+      if (func != AGGR_FUNC_COUNT_DISTINCT && func != AGGR_FUNC_APPROX_COUNT_DISTINCT) {
+        continue;
+      }
+
+      const auto field = segment->fields[selectExprs[i]->field];
+
+      if (func == AGGR_FUNC_APPROX_COUNT_DISTINCT) {
+        field->addToSketch(aggrGroup->bitmap, partial->sketches[i]);
+      } else if (field->hasStringValues()) {
+        field->distinctStrings(aggrGroup->bitmap, partial->distinctStrings[i]);
       } else {
-        if (debug) {
-          cout << "[" << aggrGroup->valueMap[selectExpr->field] << "] ";
+        field->distinctInts(aggrGroup->bitmap, partial->distinctInts[i]);
+      }
+    }
+  }
+
+  clearAggrGroups(aggregationGroups);
+  aggregationGroups.clear();
+}
+
+// filters Field::timestampFilterRange turns into a single range
+static bool isTimeRangeFilter(FilterExpr *filter) {
+  const auto &op = filter->op;
+  return filter->isLeaf() && filter->values.empty() && (op == "=" || op == "<" || op == "<=" || op == ">" || op == ">=" || op == "between" || op == "range");
+}
+
+bool Query::rollupCovers(Rollup *candidate) {
+  if (!isAggregationQuery || groupByExprs.empty()) {
+    return false;
+  }
+
+  for (auto &&selectExpr : selectExprs) {
+    const auto &func = selectExpr->aggerationFunc;
+
+    if (!selectExpr->isAggerationSelect) {
+      if (candidate->findDimension(selectExpr->field) == -1) {
+        return false;
+      }
+    } else if (func == "dateSecondsGroup") {
+      const int64_t secs = selectExpr->aggerationFuncArgs.empty() ? 0 : strtoll(selectExpr->aggerationFuncArgs[0].c_str(), nullptr, 10);
+      if (selectExpr->field != candidate->timeField || secs <= 0 || secs % candidate->granularity != 0) {
+        return false;
+      }
+    } else if (func == "count") {
+      if (selectExpr->field != "*") {
+        return false;
+      }
+    } else if (func == "sum" || func == "avg" || func == "mean") {
+      if (candidate->findMetric(selectExpr->field, "sum") == -1) {
+        return false;
+      }
+    } else if (func == "min" || func == "max" || func == "approx_count_distinct") {
+      if (candidate->findMetric(selectExpr->field, func) == -1) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+
+  for (auto &&groupByExpr : groupByExprs) {
+    if (candidate->findDimension(groupByExpr->field) != -1) {
+      continue;
+    }
+
+    // selects were checked above, any dateSecondsGroup one is on the time field
+    const auto selectExpr = findSelectExprByDisplayValue(groupByExpr->field);
+    if (table->fields.count(groupByExpr->field) == 1 || selectExpr == nullptr || selectExpr->aggerationFunc != "dateSecondsGroup") {
+      return false;
+    }
+  }
+
+  for (auto &&filter : filterExprs) {
+    if (!filter->isLeaf() || !filter->values.empty()) {
+      return false;
+    }
+
+    if (filter->field == candidate->timeField) {
+      if (!isTimeRangeFilter(filter)) {
+        return false;
+      }
+
+      // time ranges must start and end at bucket boundaries
+      int64_t from;
+      int64_t to;
+      Field::timestampFilterRange(filter->field, filter->op, filter->val, &from, &to);
+      if ((from != INT64_MIN && timeBucketStart(from, candidate->granularity) != from) || (to != INT64_MAX && timeBucketStart(to, candidate->granularity) != to)) {
+        return false;
+      }
+      continue;
+    }
+
+    const auto dimension = candidate->findDimension(filter->field);
+
+    if (dimension == -1) {
+      return false;
+    }
+
+    if (table->fields[filter->field]->type == FIELD_TYPE_BOOLEAN) {
+      if ((filter->op != "=" && filter->op != "!=") || (filter->val != "true" && filter->val != "false" && filter->val != "1" && filter->val != "0")) {
+        return false;
+      }
+    } else if (filter->op != "=") {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+Rollup *Query::findRollup() {
+  Rollup *smallest = nullptr;
+
+  for (auto &&candidate : table->rollups) {
+    if ((smallest == nullptr || candidate->size() < smallest->size()) && rollupCovers(candidate)) {
+      smallest = candidate;
+    }
+  }
+
+  return smallest;
+}
+
+void Query::runRollup(Rollup *candidate) {
+  int64_t from = INT64_MIN;
+  int64_t to = INT64_MAX;
+  // dimension and whether each of its value ids passes the filter
+  vector<pair<size_t, vector<bool>>> dimensionFilters;
+  // per group by: dimension or -1 and bucket width of dateSecondsGroup ones
+  vector<int> groupDimensions;
+  vector<int64_t> groupSeconds;
+  vector<string> groupFields;
+  // per select: metric holding its aggregate or -1
+  vector<int> selectMetrics;
+
+  for (auto &&filter : filterExprs) {
+    if (filter->field == candidate->timeField) {
+      int64_t filterFrom;
+      int64_t filterTo;
+      Field::timestampFilterRange(filter->field, filter->op, filter->val, &filterFrom, &filterTo);
+      from = std::max(from, filterFrom);
+      to = std::min(to, filterTo);
+      continue;
+    }
+
+    const auto dimension = (size_t) candidate->findDimension(filter->field);
+    auto value = filter->val;
+
+    // "= false" and "!= true" are the same on a boolean field
+    if (table->fields[filter->field]->type == FIELD_TYPE_BOOLEAN) {
+      const bool val = value == "true" || value == "1";
+      value = val == (filter->op == "=") ? "true" : "false";
+    }
+
+    const auto &values = candidate->dimensionValues[dimension];
+    vector<bool> passes(values.size());
+
+    for (size_t id = 0; id < values.size(); id++) {
+      passes[id] = values[id] == value;
+    }
+
+    dimensionFilters.push_back(make_pair(dimension, passes));
+  }
+
+  for (auto &&groupByExpr : groupByExprs) {
+    const auto dimension = candidate->findDimension(groupByExpr->field);
+
+    if (dimension != -1) {
+      groupDimensions.push_back(dimension);
+      groupSeconds.push_back(0);
+      groupFields.push_back(groupByExpr->field);
+    } else {
+      const auto selectExpr = findSelectExprByDisplayValue(groupByExpr->field);
+      groupDimensions.push_back(-1);
+      groupSeconds.push_back(strtoll(selectExpr->aggerationFuncArgs[0].c_str(), nullptr, 10));
+      groupFields.push_back(selectExpr->field);
+    }
+  }
+
+  for (auto &&selectExpr : selectExprs) {
+    const auto &func = selectExpr->aggerationFunc;
+    const bool isMetric = selectExpr->isAggerationSelect && func != "dateSecondsGroup" && func != "count";
+    const bool isSum = func == "sum" || func == "avg" || func == "mean";
+    selectMetrics.push_back(isMetric ? candidate->findMetric(selectExpr->field, isSum ? "sum" : func) : -1);
+  }
+
+  vector<string> keys(groupByExprs.size());
+
+  for (size_t row = 0; row < candidate->size(); row++) {
+    const auto bucket = candidate->buckets[row];
+    bool passes = bucket >= from && bucket < to;
+
+    for (auto &&filter : dimensionFilters) {
+      passes = passes && filter.second[candidate->dimensionIds[filter.first][row]];
+    }
+
+    if (!passes) {
+      continue;
+    }
+
+    for (size_t i = 0; i < keys.size(); i++) {
+      keys[i] = groupDimensions[i] != -1
+                ? candidate->dimensionValues[groupDimensions[i]][candidate->dimensionIds[groupDimensions[i]][row]]
+                : to_string(timeBucketStart(bucket, groupSeconds[i]));
+    }
+
+    bool first;
+    auto partial = findPartial(keys, first);
+
+    if (first) {
+      for (size_t i = 0; i < keys.size(); i++) {
+        partial->valueMap[groupFields[i]] = keys[i];
+      }
+    }
+
+    partial->count += candidate->counts[row];
+
+    for (size_t i = 0; i < selectExprs.size(); i++) {
+      const auto metric = selectMetrics[i];
+
+      if (metric != -1 && candidate->isSketch(metric)) {
+        partial->sketches[i].merge(candidate->metricSketches[metric][row]);
+      } else if (metric != -1) {
+        mergeAggregate(aggregations[i].func, aggregations[i].isSigned, first, candidate->metricValues[metric][row], partial->values[i]);
+      }
+    }
+  }
+}
+
+void Query::planAggregations() {
+  aggregations.assign(selectExprs.size(), SelectAggregation());
+  fieldAggregations.clear();
+
+  for (size_t i = 0; i < selectExprs.size(); i++) {
+    const auto selectExpr = selectExprs[i];
+    const auto &func = selectExpr->aggerationFunc;
+    const auto &args = selectExpr->aggerationFuncArgs;
+    auto &aggregation = aggregations[i];
+    char *end;
+
+    aggregation.func = AGGR_FUNC_NONE;
+    aggregation.isSigned = false;
+    aggregation.percentile = 0;
+
+    if (!selectExpr->isAggerationSelect || func == "dateSecondsGroup") {
+      continue;
+    }
+
+    if (func == "count") {
+      if (selectExpr->field != "*") {
+        throw std::runtime_error("only '*' is supported for count()");
+      }
+      aggregation.func = AGGR_FUNC_COUNT;
+      continue;
+    }
+
+    if (func == "min") {
+      aggregation.func = AGGR_FUNC_MIN;
+    } else if (func == "max") {
+      aggregation.func = AGGR_FUNC_MAX;
+    } else if (func == "sum") {
+      aggregation.func = AGGR_FUNC_SUM;
+    } else if (func == "avg" || func == "mean") {
+      aggregation.func = AGGR_FUNC_AVG;
+    } else if (func == "count_distinct") {
+      aggregation.func = AGGR_FUNC_COUNT_DISTINCT;
+    } else if (func == "approx_count_distinct") {
+      aggregation.func = AGGR_FUNC_APPROX_COUNT_DISTINCT;
+    } else if (func == "percentile") {
+      aggregation.func = AGGR_FUNC_PERCENTILE;
+    } else if (func == "histogram") {
+      aggregation.func = AGGR_FUNC_HISTOGRAM;
+    } else {
+      throw std::runtime_error("unknown aggregation function: " + func);
+    }
+
+    if (table->fields.count(selectExpr->field) == 0) {
+      throw std::runtime_error("unknown field in select: " + selectExpr->field);
+    }
+
+    const auto type = table->fields[selectExpr->field]->type;
+    aggregation.isSigned = type == FIELD_TYPE_INT || type == FIELD_TYPE_TIMESTAMP;
+
+    if (aggregation.func == AGGR_FUNC_COUNT_DISTINCT || aggregation.func == AGGR_FUNC_APPROX_COUNT_DISTINCT) {
+      continue;
+    }
+
+    // percentiles are kept as int64
+    if ((aggregation.func == AGGR_FUNC_PERCENTILE || aggregation.func == AGGR_FUNC_HISTOGRAM) && !aggregation.isSigned) {
+      throw std::runtime_error(func + " is only supported on int and timestamp fields");
+    }
+
+    if (!aggregation.isSigned && type != FIELD_TYPE_BIGINT) {
+      throw std::runtime_error(func + " is only supported on int, bigint and timestamp fields");
+    }
+
+    // percentile(field, p), p in [0, 100]
+    if (aggregation.func == AGGR_FUNC_PERCENTILE) {
+      const double p = args.size() == 1 ? strtod(args[0].c_str(), &end) : -1;
+      if (args.size() != 1 || *end != '\0' || !(p >= 0 && p <= 100)) {
+        throw std::runtime_error("percentile expects a percentage between 0 and 100");
+      }
+      aggregation.percentile = p;
+    }
+
+    // histogram(field, b1, b2, ...) counts rows below b1, in [b1, b2) ... and from the last bound on
+    if (aggregation.func == AGGR_FUNC_HISTOGRAM) {
+      auto &bounds = aggregation.histogramBounds;
+
+      for (auto &&arg : args) {
+        const int64_t bound = strtoll(arg.c_str(), &end, 10);
+        if (arg.empty() || *end != '\0' || (!bounds.empty() && bound <= bounds.back())) {
+          throw std::runtime_error("histogram expects increasing integer bucket bounds");
         }
-        row->values.push_back(new GenericValueContainer(aggrGroup->valueMap[selectExpr->field]));
+        bounds.push_back(bound);
+      }
+
+      if (bounds.empty()) {
+        throw std::runtime_error("histogram expects increasing integer bucket bounds");
+      }
+    }
+
+    // every aggregate of a field is computed while its values are read once
+    auto plan = std::find_if(fieldAggregations.begin(), fieldAggregations.end(), [&](const FieldAggregation &existing) {
+      return existing.field == selectExpr->field;
+    });
+
+    if (plan == fieldAggregations.end()) {
+      fieldAggregations.push_back(FieldAggregation{selectExpr->field, 0, false, vector<size_t>(), nullptr});
+      plan = fieldAggregations.end() - 1;
+    }
+
+    switch (aggregation.func) {
+      case AGGR_FUNC_MIN: plan->kinds |= FIELD_AGGR_MIN; break;
+      case AGGR_FUNC_MAX: plan->kinds |= FIELD_AGGR_MAX; break;
+      case AGGR_FUNC_SUM:
+      case AGGR_FUNC_AVG: plan->kinds |= FIELD_AGGR_SUM; break;
+      default: plan->readsValues = true; break;
+    }
+
+    plan->selects.push_back(i);
+  }
+
+  for (auto &&plan : fieldAggregations) {
+    const auto field = table->fields[plan.field];
+    plan.kernel = findAggregateKernel(field->type, field->encoding, plan.kinds, plan.readsValues);
+  }
+}
+
+void Query::genResultRows() {
+  for (auto &&partial : partialAggregates) {
+    auto row = new QueryResultRow();
+
+    for (size_t i = 0; i < selectExprs.size(); i++) {
+      const auto selectExpr = selectExprs[i];
+      const auto &aggregation = aggregations[i];
+      GenericValueContainer *value;
+
+      switch (aggregation.func) {
+        case AGGR_FUNC_NONE: {
+          value = new GenericValueContainer(partial->valueMap[selectExpr->field]);
+        } break;
+        case AGGR_FUNC_COUNT: {
+          value = new GenericValueContainer(partial->count);
+        } break;
+        case AGGR_FUNC_COUNT_DISTINCT: {
+          value = new GenericValueContainer((uint64_t) (partial->distinctStrings[i].size() + partial->distinctInts[i].size()));
+        } break;
+        case AGGR_FUNC_APPROX_COUNT_DISTINCT: {
+          value = new GenericValueContainer(partial->sketches[i].estimate());
+        } break;
+        case AGGR_FUNC_PERCENTILE: {
+          // sign extended like min and max of int fields
+          value = new GenericValueContainer((uint64_t) partial->quantiles[i].percentile(aggregation.percentile));
+        } break;
+        case AGGR_FUNC_HISTOGRAM: {
+          value = new GenericValueContainer(partial->histograms[i]);
+        } break;
+        case AGGR_FUNC_AVG: {
+          const double sum = aggregation.isSigned ? (double) (int64_t) partial->values[i] : (double) partial->values[i];
+          value = new GenericValueContainer(partial->count > 0 ? sum / partial->count : 0.0);
+        } break;
+        default: {
+          value = new GenericValueContainer(partial->values[i]);
+        } break;
       }
+
+      if (debug) {
+        cout << "[" << (value->type == FIELD_TYPE_STRING ? value->strVal : value->type == FIELD_TYPE_DOUBLE ? to_string(value->dVal) : to_string(value->u64Val)) << "] ";
+      }
+
+      row->values.push_back(value);
     }
 
     if (debug) {
@@ -235,6 +1020,10 @@ void Query::applyOrder() {
       const auto val1 = row1->values[fieldIndex];
       const auto val2 = row2->values[fieldIndex];
 
+      if (val1->isArray) {
+        throw std::runtime_error("can not order by " + orderByExpr->field);
+      }
+
       if (val1->type == FIELD_TYPE_INT) {
         int ival1 = val1->getIVal();
         int ival2 = val2->getIVal();
@@ -243,6 +1032,18 @@ void Query::applyOrder() {
           return !orderByExpr->asc;
         }
 
+        if (ival1 < ival2) {
+          return orderByExpr->asc;
+        }
+      } else if (val1->type == FIELD_TYPE_BIGINT && (size_t) fieldIndex < query->aggregations.size() && query->aggregations[fieldIndex].isSigned) {
+        // aggregates of signed fields are sign extended
+        int64_t ival1 = (int64_t) val1->getUInt64Val();
+        int64_t ival2 = (int64_t) val2->getUInt64Val();
+
+        if (ival1 > ival2) {
+          return !orderByExpr->asc;
+        }
+
         if (ival1 < ival2) {
           return orderByExpr->asc;
         }
@@ -257,6 +1058,17 @@ void Query::applyOrder() {
         if (ival1 < ival2) {
           return orderByExpr->asc;
         }
+      } else if (val1->type == FIELD_TYPE_DOUBLE) {
+        double dval1 = val1->getDVal();
+        double dval2 = val2->getDVal();
+
+        if (dval1 > dval2) {
+          return !orderByExpr->asc;
+        }
+
+        if (dval1 < dval2) {
+          return orderByExpr->asc;
+        }
       } else if (val1->type == FIELD_TYPE_STRING) {
         const auto strVal1 = val1->getStrVal();
         const auto strVal2 = val2->getStrVal();
@@ -312,12 +1124,20 @@ void Query::printResultRows() {
     for (auto i = 0; i < selectExprCount; i++) {
       const auto value = row->values[i];
 
-      if (value->type == FIELD_TYPE_STRING) {
+      if (value->isArray && value->type == FIELD_TYPE_BIGINT) {
+        for (size_t j = 0; j < value->u64ArrVal.size(); j++) {
+          cout << (j > 0 ? " " : "") << value->u64ArrVal[j];
+        }
+      } else if (value->type == FIELD_TYPE_STRING) {
         cout << value->getStrVal();
       } else if (value->type == FIELD_TYPE_INT) {
         cout << value->getIVal();
+      } else if (value->type == FIELD_TYPE_BIGINT && (size_t) i < aggregations.size() && aggregations[i].isSigned) {
+        cout << (int64_t) value->getUInt64Val();
       } else if (value->type == FIELD_TYPE_BIGINT) {
         cout << value->getUInt64Val();
+      } else if (value->type == FIELD_TYPE_DOUBLE) {
+        cout << value->getDVal();
       } else {
         throw std::runtime_error("unspported value type in result rows");
       }
@@ -331,37 +1151,279 @@ void Query::printResultRows() {
   }
 }
 
+int Query::defaultParallelism = 1;
+
+// threads of parallel queries, one per cpu counting the thread running the query
+static ThreadPool &sharedThreadPool() {
+  static ThreadPool pool(std::max(1u, thread::hardware_concurrency()) - 1);
+  return pool;
+}
+
+Query::Query(Query *parent) {
+  selectExprs = parent->selectExprs;
+  filterExprs = parent->filterExprs;
+  groupByExprs = parent->groupByExprs;
+  isAggregationQuery = parent->isAggregationQuery;
+  table = parent->table;
+  initialBitmap = nullptr;
+  segment = nullptr;
+  rollup = nullptr;
+  debug = parent->debug;
+  limit = -1;
+  parallelism = 1;
+  ownsExprs = false;
+  aggregations = parent->aggregations;
+  fieldAggregations = parent->fieldAggregations;
+  stats.scratch_bytes = 0;
+}
+
+void Query::mergePartials(Query *worker) {
+  for (auto &&partial : worker->partialAggregates) {
+    bool first;
+    auto merged = findPartial(partial->keys, first);
+
+    if (first) {
+      merged->valueMap = partial->valueMap;
+    }
+
+    merged->count += partial->count;
+
+    for (size_t i = 0; i < selectExprs.size(); i++) {
+      const auto &aggregation = aggregations[i];
+
+      switch (aggregation.func) {
+        case AGGR_FUNC_MIN:
+        case AGGR_FUNC_MAX:
+        case AGGR_FUNC_SUM:
+        case AGGR_FUNC_AVG: {
+          mergeAggregate(aggregation.func, aggregation.isSigned, first, partial->values[i], merged->values[i]);
+        } break;
+        case AGGR_FUNC_COUNT_DISTINCT: {
+          merged->distinctStrings[i].insert(partial->distinctStrings[i].begin(), partial->distinctStrings[i].end());
+          merged->distinctInts[i].insert(partial->distinctInts[i].begin(), partial->distinctInts[i].end());
+        } break;
+        case AGGR_FUNC_APPROX_COUNT_DISTINCT: {
+          merged->sketches[i].merge(partial->sketches[i]);
+        } break;
+        case AGGR_FUNC_PERCENTILE: {
+          merged->quantiles[i].merge(partial->quantiles[i]);
+        } break;
+        case AGGR_FUNC_HISTOGRAM: {
+          for (size_t j = 0; j < partial->histograms[i].size(); j++) {
+            merged->histograms[i][j] += partial->histograms[i][j];
+          }
+        } break;
+      }
+    }
+  }
+}
+
+void Query::runParallel(const vector<Segment *> &segments, size_t workers, int64_t &filterUs, int64_t &groupUs) {
+  auto &pool = sharedThreadPool();
+  chrono::time_point<chrono::system_clock> start;
+  chrono::duration<double> elapsed;
+  vector<Query *> workerQueries;
+  // filtered rows of each segment
+  vector<roaring_bitmap_t *> filtered(segments.size(), nullptr);
+  // segment and first row of each range of rows grouped by one task
+  vector<pair<size_t, uint32_t>> ranges;
+  int64_t scratchBytes = 0;
+
+  for (size_t i = 0; i < workers; i++) {
+    workerQueries.push_back(new Query(this));
+  }
+
+  try {
+    // filters look up bitmaps of whole segments, so segments are filtered by one task each
+    start = std::chrono::system_clock::now();
+
+    pool.run(segments.size(), workers, [&](size_t task, size_t worker) {
+      const auto query = workerQueries[worker];
+      query->segment = segments[task];
+      query->applyFilters();
+      filtered[task] = query->initialBitmap;
+      query->initialBitmap = nullptr;
+    });
+
+    elapsed = std::chrono::system_clock::now() - start;
+    filterUs += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+
+    // filtered rows are grouped and aggregated by roaring containers,
+    // each holding the rows sharing the high 16 bits of their ids
+    start = std::chrono::system_clock::now();
+
+    for (size_t i = 0; i < segments.size(); i++) {
+      if (roaring_bitmap_is_empty(filtered[i])) {
+        continue;
+      }
+
+      const uint32_t last = roaring_bitmap_maximum(filtered[i]) >> 16;
+
+      for (uint32_t chunk = roaring_bitmap_minimum(filtered[i]) >> 16; chunk <= last; chunk++) {
+        ranges.push_back(make_pair(i, chunk << 16));
+      }
+    }
+
+    pool.run(ranges.size(), workers, [&](size_t task, size_t worker) {
+      const auto query = workerQueries[worker];
+      const uint64_t first = ranges[task].second;
+      auto rows = roaring_bitmap_from_range(first, first + (1 << 16), 1);
+
+      roaring_bitmap_and_inplace(rows, filtered[ranges[task].first]);
+
+      if (roaring_bitmap_is_empty(rows)) {
+        roaring_bitmap_free(rows);
+        return;
+      }
+
+      query->segment = segments[ranges[task].first];
+      query->initialBitmap = rows;
+      query->genAggrGroups();
+      query->mergeAggrGroups();
+      roaring_bitmap_free(query->initialBitmap);
+      query->initialBitmap = nullptr;
+    });
+
+    // groups first seen by lower workers come first
+    // measured once per worker, walking the groups is not free
+    for (auto &&query : workerQueries) {
+      scratchBytes += query->statUsedMemory();
+      mergePartials(query);
+    }
+
+    elapsed = std::chrono::system_clock::now() - start;
+    groupUs += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+  } catch (...) {
+    for (auto &&bitmap : filtered) {
+      if (bitmap != nullptr) {
+        roaring_bitmap_free(bitmap);
+      }
+    }
+
+    for (auto &&query : workerQueries) {
+      delete query;
+    }
+
+    throw;
+  }
+
+  for (auto &&bitmap : filtered) {
+    roaring_bitmap_free(bitmap);
+  }
+
+  for (auto &&query : workerQueries) {
+    delete query;
+  }
+
+  stats.scratch_bytes = scratchBytes;
+}
+
 void Query::run() {
-  // prepare initial bitmap
-  roaring_bitmap_t *roar;
   chrono::time_point<chrono::system_clock> start;
   chrono::duration<double> elapsed;
-  long long duration;
+  int64_t filterUs = 0;
+  int64_t groupUs = 0;
 
-  if (table->size > 0) {
-    roar = roaring_bitmap_from_range(1, table->size + 1, 1);
-  } else {
-    roar = roaring_bitmap_create();
+  int64_t from = INT64_MIN;
+  int64_t to = INT64_MAX;
+
+  stats.scratch_bytes = 0;
+  stats.skipped_segments = 0;
+
+  planAggregations();
+
+  rollup = findRollup();
+
+  // time range filters on the partition field skip whole partitions
+  if (table->partitionSeconds > 0) {
+    for (auto &&filter : filterExprs) {
+      if (filter->field == table->partitionField && isTimeRangeFilter(filter)) {
+        int64_t filterFrom;
+        int64_t filterTo;
+        Field::timestampFilterRange(filter->field, filter->op, filter->val, &filterFrom, &filterTo);
+        from = std::max(from, filterFrom);
+        to = std::min(to, filterTo);
+      }
+    }
   }
-  initialBitmap = roar;
 
-  // apply filters
-  start = std::chrono::system_clock::now();
-  applyFilters();
-  elapsed = std::chrono::system_clock::now() - start;
-  stats.filter_us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
-  stats.filter_ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+  if (rollup != nullptr) {
+    if (debug) {
+      cout << "answering from rollup " << rollup->name << endl;
+    }
 
-  // apply groups
-  start = std::chrono::system_clock::now();
-  genAggrGroups();
-  elapsed = std::chrono::system_clock::now() - start;
-  stats.group_us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
-  stats.group_ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    start = std::chrono::system_clock::now();
+    runRollup(rollup);
+    elapsed = std::chrono::system_clock::now() - start;
+    groupUs += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+  }
+
+  // segments are filtered and grouped one by one,
+  // their groups are merged into partialAggregates.
+  // no segment is read when a rollup answered the query.
+  const map<int64_t, vector<Segment *>> noPartitions;
+  vector<Segment *> segments;
+
+  for (auto &&partition : rollup != nullptr ? noPartitions : table->partitions) {
+    if (!table->partitionOverlaps(partition.first, from, to)) {
+      stats.skipped_segments += partition.second.size();
+      continue;
+    }
+
+    for (auto &&segment_ : partition.second) {
+      if (segment_->size > 0) {
+        segments.push_back(segment_);
+      }
+    }
+  }
+
+  const int workers = parallelism > 0 ? parallelism : defaultParallelism;
+
+  if (workers > 1 && !segments.empty()) {
+    runParallel(segments, std::min((size_t) workers, sharedThreadPool().size()), filterUs, groupUs);
+    segments.clear();
+  }
+
+  for (auto &&segment_ : segments) {
+    segment = segment_;
+
+    // apply filters
+    start = std::chrono::system_clock::now();
+
+    applyFilters();
+    elapsed = std::chrono::system_clock::now() - start;
+    filterUs += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+
+    if (roaring_bitmap_is_empty(initialBitmap)) {
+      roaring_bitmap_free(initialBitmap);
+      initialBitmap = nullptr;
+      continue;
+    }
+
+    // apply groups
+    start = std::chrono::system_clock::now();
+    genAggrGroups();
+    mergeAggrGroups();
+    elapsed = std::chrono::system_clock::now() - start;
+    groupUs += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+
+    roaring_bitmap_free(initialBitmap);
+    initialBitmap = nullptr;
+  }
+
+  segment = nullptr;
+
+  stats.filter_us = filterUs;
+  stats.filter_ms = filterUs / 1000;
+  stats.group_us = groupUs;
+  stats.group_ms = groupUs / 1000;
 
   // generate rows
   genResultRows();
 
+  // measured once, after the groups of all segments got merged
+  stats.scratch_bytes = std::max(stats.scratch_bytes, statUsedMemory());
+
   // apply order
   start = std::chrono::system_clock::now();
   applyOrder();
@@ -371,8 +1433,65 @@ void Query::run() {
 
   // apply limit
   applyLimit();
+}
 
-  // reset initial bitmap
-  initialBitmap = nullptr;
-  roaring_bitmap_free(roar);
+int64_t Query::statUsedMemory() {
+  int64_t sum = sizeof(Query);
+
+  if (initialBitmap != nullptr) {
+    sum += bitmapUsedMemory(initialBitmap);
+  }
+
+  for (auto &&selectExpr : selectExprs) {
+    for (auto &&group : selectExpr->groups) {
+      sum += MAP_NODE_OVERHEAD + sizeof(group) + group.first.capacity() + bitmapUsedMemory(group.second);
+    }
+  }
+
+  sum += sizeof(AggregationGroup *) * aggregationGroups.capacity();
+
+  for (auto &&group : aggregationGroups) {
+    sum += sizeof(AggregationGroup) + sizeof(string) * group->keys.capacity();
+    for (auto &&key : group->keys) {
+      sum += key.capacity();
+    }
+    for (auto &&value : group->valueMap) {
+      sum += MAP_NODE_OVERHEAD + sizeof(value) + value.first.capacity() + value.second.capacity();
+    }
+    if (group->bitmap != nullptr) {
+      sum += bitmapUsedMemory(group->bitmap);
+    }
+  }
+
+  sum += sizeof(PartialAggregate *) * partialAggregates.capacity();
+
+  for (auto &&partial : partialAggregates) {
+    sum += sizeof(PartialAggregate) + sizeof(string) * partial->keys.capacity() + sizeof(uint64_t) * partial->values.capacity();
+    for (auto &&key : partial->keys) {
+      sum += key.capacity();
+    }
+    for (auto &&value : partial->valueMap) {
+      sum += MAP_NODE_OVERHEAD + sizeof(value) + value.first.capacity() + value.second.capacity();
+    }
+    for (size_t i = 0; i < partial->sketches.size(); i++) {
+      sum += sizeof(unordered_set<string>) + sizeof(unordered_set<uint64_t>) + sizeof(HyperLogLog) + partial->sketches[i].statUsedMemory();
+      sum += sizeof(QuantileSketch) + partial->quantiles[i].statUsedMemory();
+      sum += sizeof(vector<uint64_t>) + sizeof(uint64_t) * partial->histograms[i].capacity();
+      sum += sizeof(void *) * (partial->distinctStrings[i].bucket_count() + partial->distinctInts[i].bucket_count());
+      sum += (MAP_NODE_OVERHEAD + sizeof(uint64_t)) * partial->distinctInts[i].size();
+      // heap of values longer than the short string buffer is not counted
+      sum += (MAP_NODE_OVERHEAD + sizeof(string)) * partial->distinctStrings[i].size();
+    }
+  }
+
+  sum += sizeof(QueryResultRow *) * result.rows.capacity();
+
+  for (auto &&row : result.rows) {
+    sum += sizeof(QueryResultRow) + sizeof(GenericValueContainer *) * row->values.capacity();
+    for (auto &&value : row->values) {
+      sum += sizeof(GenericValueContainer) + value->strVal.capacity();
+    }
+  }
+
+  return sum;
 }
@@ -1,8 +1,12 @@
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include "roaring/roaring.h"
 #include "table.h"
 #include "generic-value.h"
+#include "quantile-sketch.h"
+#include "aggregate-kernel.h"
 #include "utils.h"
 
 #ifndef MERLIN_QUERY_H
@@ -10,6 +14,18 @@
 
 using namespace std;
 
+// aggregation functions of select expressions, resolved once per query
+const int AGGR_FUNC_NONE = 0; // plain fields and dateSecondsGroup
+const int AGGR_FUNC_COUNT = 1;
+const int AGGR_FUNC_MIN = 2;
+const int AGGR_FUNC_MAX = 3;
+const int AGGR_FUNC_SUM = 4;
+const int AGGR_FUNC_AVG = 5;
+const int AGGR_FUNC_COUNT_DISTINCT = 6;
+const int AGGR_FUNC_APPROX_COUNT_DISTINCT = 7;
+const int AGGR_FUNC_PERCENTILE = 8;
+const int AGGR_FUNC_HISTOGRAM = 9;
+
 class SelectExpr {
   public:
   string field;
@@ -25,17 +41,44 @@ class SelectExpr {
   SelectExpr(string field_, string aggerationFunc_, string display_): field(field_), aggerationFunc(aggerationFunc_), display(display_), isAggerationSelect(true) {}
   ~SelectExpr() {
     for (auto &&it : groups) {
-      delete it.second;
+      roaring_bitmap_free(it.second);
     }
   }
 };
 
+class FilterExpr;
+
+// bitmap of a filter on the segment being processed
+struct FilterBitmap {
+  FilterExpr *filter;
+  roaring_bitmap_t *bitmap;
+  bool owned;
+  uint64_t cardinality;
+};
+
+// either a condition on a field or, when it has children,
+// an "and", "or" or "not" of other filter expressions
 class FilterExpr {
   public:
   string field;
   string op; // operator
   string val;
+  // set instead of val for operators taking a list, e.g. in and contains_any
+  vector<string> values;
+  vector<FilterExpr *> children;
   FilterExpr(string field_, string op_, string val_): field(field_), op(op_), val(val_) {}
+  FilterExpr(string field_, string op_, vector<string> values_): field(field_), op(op_), values(values_) {}
+  FilterExpr(string op_, vector<FilterExpr *> children_): op(op_), children(children_) {}
+
+  ~FilterExpr() {
+    for (auto &&child : children) {
+      delete child;
+    }
+  }
+
+  bool isLeaf() const {
+    return children.empty();
+  }
 };
 
 class GroupByExpr {
@@ -64,6 +107,9 @@ class AggregationGroup {
     bitmap = roaring_bitmap_copy(initialBitmap);
   }
 
+  // takes ownership of bitmap
+  AggregationGroup(vector<string> keys_, map<string, string> valueMap_, roaring_bitmap_t *bitmap_): keys(keys_), bitmap(bitmap_), valueMap(valueMap_) {}
+
   AggregationGroup(AggregationGroup *group, bool copyBitmap = true) {
     keys = group->keys;
     valueMap = group->valueMap;
@@ -87,6 +133,26 @@ class AggregationGroup {
   }
 };
 
+// aggregates of a group merged over segments.
+// values hold one entry per select expression: min, max or sum
+// for aggregation functions, sum for avg, unused for the others.
+class PartialAggregate {
+  public:
+  vector<string> keys;
+  map<string, string> valueMap; // field > value
+  uint64_t count;
+  vector<uint64_t> values;
+  // per select expression: values seen by count_distinct,
+  // in one of the sets depending on field type
+  vector<unordered_set<string>> distinctStrings;
+  vector<unordered_set<uint64_t>> distinctInts;
+  // per select expression: approx_count_distinct sketch
+  vector<HyperLogLog> sketches;
+  // per select expression: values of percentile and row counts of histogram
+  vector<QuantileSketch> quantiles;
+  vector<vector<uint64_t>> histograms;
+};
+
 class QueryResultRow {
   public:
   vector<GenericValueContainer *> values;
@@ -115,13 +181,25 @@ class Query {
   vector<FilterExpr *> filterExprs;
   vector<GroupByExpr *> groupByExprs;
   vector<OrderByExpr *> orderByExprs;
+  // groups of the segment being processed
   vector<AggregationGroup *> aggregationGroups;
+  // groups of all processed segments, in the order they were first seen
+  vector<PartialAggregate *> partialAggregates;
   int limit;
   bool isAggregationQuery;
   QueryResult result;
   roaring_bitmap_t *initialBitmap;
   Table *table;
+  // segment filters and groups are applied to
+  Segment *segment;
+  // rollup the query was answered from, nullptr when it read rows
+  Rollup *rollup;
   bool debug;
+  // threads filtering, grouping and aggregating segments, 0 uses defaultParallelism.
+  // it is capped by the number of cpus.
+  int parallelism;
+  // parallelism of queries not setting their own
+  static int defaultParallelism;
 
   struct {
     int64_t filter_us;
@@ -132,52 +210,131 @@ class Query {
 
     int64_t order_us;
     int64_t order_ms;
+
+    // memory held by the query once result rows are generated
+    int64_t scratch_bytes;
+
+    // segments of partitions outside the time filters
+    int64_t skipped_segments;
   } stats;
 
   Query(Table *table_, bool debug_ = false) {
     table = table_;
     initialBitmap = nullptr;
+    segment = nullptr;
+    rollup = nullptr;
     debug = debug_;
     limit = -1;
+    parallelism = 0;
   }
 
   ~Query() {
-    for (auto &&select : selectExprs) {
-      delete select;
-    }
-
-    for (auto &&filterExpr : filterExprs) {
-      delete filterExpr;
-    }
-
-    for (auto &&groupByExpr : groupByExprs) {
-      delete groupByExpr;
-    }
-
-    for (auto &&orderByExpr : orderByExprs) {
-      delete orderByExpr;
+    if (ownsExprs) {
+      for (auto &&select : selectExprs) {
+        delete select;
+      }
+
+      for (auto &&filterExpr : filterExprs) {
+        delete filterExpr;
+      }
+
+      for (auto &&groupByExpr : groupByExprs) {
+        delete groupByExpr;
+      }
+
+      for (auto &&orderByExpr : orderByExprs) {
+        delete orderByExpr;
+      }
     }
 
     for (auto &&aggregationGroup : aggregationGroups) {
       delete aggregationGroup;
     }
 
+    for (auto &&partialAggregate : partialAggregates) {
+      delete partialAggregate;
+    }
+
     if (initialBitmap != nullptr) {
-      delete initialBitmap;
+      roaring_bitmap_free(initialBitmap);
     }
   }
 
+  // builds initialBitmap of the current segment from filters
   void applyFilters();
   void genAggrGroups();
+  // folds aggregationGroups of the current segment into partialAggregates
+  void mergeAggrGroups();
   void genResultRows();
   void applyOrder();
   void applyLimit();
   void printResultRows();
   void run();
 
+  // memory held by filter bitmaps, aggregation groups and result rows
+  int64_t statUsedMemory();
+
   private:
+  // false for workers of a parallel query, they use the expressions of their parent
+  bool ownsExprs = true;
+  // partialAggregates index by joined group keys
+  unordered_map<string, size_t> partialIndex;
+  // aggregation of a select expression
+  struct SelectAggregation {
+    int func; // AGGR_FUNC_*
+    // values of int and timestamp fields are kept sign extended
+    bool isSigned;
+    // parsed arguments of percentile and histogram
+    double percentile;
+    vector<int64_t> histogramBounds;
+  };
+
+  // selects aggregating a field in one kernel pass per group:
+  // min, max, sum, avg, percentile and histogram
+  struct FieldAggregation {
+    string field;
+    int kinds; // FIELD_AGGR_* mask
+    // whether percentile or histogram selects need the values read
+    bool readsValues;
+    vector<size_t> selects;
+    // chosen once the selects are known
+    AggregateKernel kernel;
+  };
+
+  // per select expression
+  vector<SelectAggregation> aggregations;
+  vector<FieldAggregation> fieldAggregations;
+
+  // validates aggregations of selects and fills aggregations and fieldAggregations
+  void planAggregations();
+
+  // partial aggregate of a group, created when first seen is set
+  PartialAggregate *findPartial(const vector<string> &keys, bool &first);
+  // rows of the current segment matching a filter expression, null when none does.
+  // owned is set when the returned bitmap must be freed by the caller.
+  roaring_bitmap_t *evaluateFilter(FilterExpr *filter, bool &owned);
+  // rows matching all or any of the filters, the result is owned
+  roaring_bitmap_t *intersectFilters(const vector<FilterExpr *> &filters);
+  roaring_bitmap_t *unionFilters(const vector<FilterExpr *> &filters);
+  void lookupFilterBitmaps(const vector<FilterExpr *> &filters, vector<FilterBitmap> &bitmaps, bool &empty);
+  double estimateFilterCost(FilterExpr *filter);
   int findSelectFieldIndex(string field);
+  void resolveGroupBy(GroupByExpr *groupByExpr, Field **field, SelectExpr **aggrSelectExpr);
+  bool shouldGroupByScan();
+  void genAggrGroupsScan();
   SelectExpr *findSelectExprByDisplayValue(string displayValue);
+  // smallest rollup covering the query or nullptr
+  Rollup *findRollup();
+  bool rollupCovers(Rollup *candidate);
+  // fills partialAggregates from rollup rows
+  void runRollup(Rollup *candidate);
+
+  // worker of a parallel query, sharing the expressions and aggregation plan of parent
+  explicit Query(Query *parent);
+  // filters, groups and aggregates segments on worker threads
+  void runParallel(const vector<Segment *> &segments, size_t workers, int64_t &filterUs, int64_t &groupUs);
+  // folds partial aggregates of a worker into partialAggregates
+  void mergePartials(Query *worker);
 };
 
 void runQuery(Table *table);
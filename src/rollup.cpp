@@ -0,0 +1,364 @@
+#include <stdexcept>
+#include <algorithm>
+#include "rollup.h"
+#include "insert-batch.h"
+#include "utils.h"
+
+using namespace std;
+
+string rollupDimensionValue(const GenericValueContainer &value) {
+  if (value.type == FIELD_TYPE_BOOLEAN) {
+    return value.bVal ? "true" : "false";
+  }
+
+  return value.strVal;
+}
+
+Rollup::Rollup(const string &name_, const string &timeField_, int64_t granularity_, const vector<string> &dimensions_, const vector<RollupMetric> &metrics_)
+  : name(name_), timeField(timeField_), granularity(granularity_), dimensions(dimensions_), metrics(metrics_) {
+  if (granularity <= 0) {
+    throw std::runtime_error("rollup " + name + ": invalid granularity " + to_string(granularity));
+  }
+
+  for (auto &&metric : metrics) {
+    if (metric.func != "sum" && metric.func != "min" && metric.func != "max" && metric.func != "approx_count_distinct") {
+      throw std::runtime_error("rollup " + name + ": unsupported function " + metric.func);
+    }
+  }
+
+  dimensionIds.resize(dimensions.size());
+  dimensionValues.resize(dimensions.size());
+  dimensionIndex.resize(dimensions.size());
+  metricValues.resize(metrics.size());
+  metricSketches.resize(metrics.size());
+}
+
+int Rollup::findDimension(const string &field) const {
+  for (size_t i = 0; i < dimensions.size(); i++) {
+    if (dimensions[i] == field) {
+      return (int) i;
+    }
+  }
+
+  return -1;
+}
+
+int Rollup::findMetric(const string &field, const string &func) const {
+  for (size_t i = 0; i < metrics.size(); i++) {
+    if (metrics[i].field == field && metrics[i].func == func) {
+      return (int) i;
+    }
+  }
+
+  return -1;
+}
+
+uint32_t Rollup::dimensionId(size_t dimension, const string &value) {
+  const auto inserted = dimensionIndex[dimension].emplace(value, (uint32_t) dimensionValues[dimension].size());
+
+  if (inserted.second) {
+    dimensionValues[dimension].push_back(value);
+  }
+
+  return inserted.first->second;
+}
+
+string Rollup::rowKey(int64_t bucket, const uint32_t *ids) const {
+  string key((const char *) &bucket, sizeof(bucket));
+  key.append((const char *) ids, sizeof(uint32_t) * dimensions.size());
+  return key;
+}
+
+// same hashes as Field::addToSketch gives for stored values
+static void addToSketch(const GenericValueContainer &value, HyperLogLog &sketch) {
+  switch (value.type) {
+    case FIELD_TYPE_TIMESTAMP: sketch.add(hashValue((uint64_t) value.i64Val)); break;
+    case FIELD_TYPE_INT: sketch.add(hashValue((uint64_t) (int64_t) value.iVal)); break;
+    case FIELD_TYPE_BIGINT: sketch.add(hashValue(value.u64Val)); break;
+    case FIELD_TYPE_BOOLEAN: sketch.add(hashValue(string(value.bVal ? "true" : "false"))); break;
+    default: {
+      if (!value.isArray) {
+        sketch.add(hashValue(value.strVal));
+      }
+      for (auto &&tag : value.strArrVal) {
+        sketch.add(hashValue(tag));
+      }
+    } break;
+  }
+}
+
+static size_t findBatchColumn(const InsertBatch &batch, const string &field) {
+  for (size_t i = 0; i < batch.fields.size(); i++) {
+    if (batch.fields[i] == field) {
+      return i;
+    }
+  }
+
+  throw std::runtime_error("insert batch has no field " + field);
+}
+
+void Rollup::add(const InsertBatch &batch) {
+  const auto &timestamps = batch.columns[findBatchColumn(batch, timeField)];
+  vector<const vector<GenericValueContainer> *> dimensionColumns;
+  vector<const vector<GenericValueContainer> *> metricColumns;
+  vector<uint32_t> ids(dimensions.size());
+
+  for (auto &&dimension : dimensions) {
+    dimensionColumns.push_back(&batch.columns[findBatchColumn(batch, dimension)]);
+  }
+
+  for (auto &&metric : metrics) {
+    metricColumns.push_back(&batch.columns[findBatchColumn(batch, metric.field)]);
+  }
+
+  for (uint32_t row = 0; row < batch.rowCount; row++) {
+    const int64_t bucket = timeBucketStart(timestamps[row].i64Val, granularity);
+
+    for (size_t i = 0; i < dimensions.size(); i++) {
+      ids[i] = dimensionId(i, rollupDimensionValue((*dimensionColumns[i])[row]));
+    }
+
+    const auto inserted = rowIndex.emplace(rowKey(bucket, ids.data()), (uint32_t) counts.size());
+    const auto index = inserted.first->second;
+
+    if (inserted.second) {
+      buckets.push_back(bucket);
+      counts.push_back(0);
+      for (size_t i = 0; i < dimensions.size(); i++) {
+        dimensionIds[i].push_back(ids[i]);
+      }
+    }
+
+    counts[index]++;
+
+    for (size_t i = 0; i < metrics.size(); i++) {
+      const auto &value = (*metricColumns[i])[row];
+
+      if (isSketch(i)) {
+        if (inserted.second) {
+          metricSketches[i].emplace_back();
+        }
+        addToSketch(value, metricSketches[i][index]);
+        continue;
+      }
+
+      const bool isInt = metrics[i].type == FIELD_TYPE_INT;
+      // int values are sign extended like Field aggregations return them
+      const uint64_t v = isInt ? (uint64_t) (int64_t) value.iVal : value.u64Val;
+
+      if (inserted.second) {
+        metricValues[i].push_back(v);
+      } else if (metrics[i].func == "sum") {
+        metricValues[i][index] += v;
+      } else if (metrics[i].func == "min") {
+        auto &current = metricValues[i][index];
+        current = (isInt ? (int64_t) v < (int64_t) current : v < current) ? v : current;
+      } else {
+        auto &current = metricValues[i][index];
+        current = (isInt ? (int64_t) v > (int64_t) current : v > current) ? v : current;
+      }
+    }
+  }
+}
+
+void Rollup::dropBefore(int64_t time) {
+  size_t kept = 0;
+
+  for (size_t row = 0; row < counts.size(); row++) {
+    if (buckets[row] < time) {
+      continue;
+    }
+
+    buckets[kept] = buckets[row];
+    counts[kept] = counts[row];
+    for (auto &&ids : dimensionIds) {
+      ids[kept] = ids[row];
+    }
+    for (auto &&values : metricValues) {
+      if (!values.empty()) {
+        values[kept] = values[row];
+      }
+    }
+    for (auto &&sketches : metricSketches) {
+      if (!sketches.empty()) {
+        sketches[kept].registers.swap(sketches[row].registers);
+      }
+    }
+    kept++;
+  }
+
+  if (kept == counts.size()) {
+    return;
+  }
+
+  buckets.resize(kept);
+  counts.resize(kept);
+  for (auto &&ids : dimensionIds) {
+    ids.resize(kept);
+  }
+  for (auto &&values : metricValues) {
+    values.resize(std::min(values.size(), kept));
+  }
+  for (auto &&sketches : metricSketches) {
+    sketches.resize(std::min(sketches.size(), kept));
+  }
+
+  rebuildIndex();
+}
+
+void Rollup::rebuildIndex() {
+  vector<uint32_t> ids(dimensions.size());
+
+  rowIndex.clear();
+
+  for (size_t row = 0; row < counts.size(); row++) {
+    for (size_t i = 0; i < dimensions.size(); i++) {
+      ids[i] = dimensionIds[i][row];
+    }
+    rowIndex[rowKey(buckets[row], ids.data())] = (uint32_t) row;
+  }
+
+  for (size_t i = 0; i < dimensions.size(); i++) {
+    dimensionIndex[i].clear();
+    for (size_t id = 0; id < dimensionValues[i].size(); id++) {
+      dimensionIndex[i][dimensionValues[i][id]] = (uint32_t) id;
+    }
+  }
+}
+
+int64_t Rollup::statUsedMemory() const {
+  int64_t sum = sizeof(Rollup) + name.capacity() + timeField.capacity();
+  const int64_t keySize = sizeof(int64_t) + sizeof(uint32_t) * dimensions.size();
+
+  sum += sizeof(int64_t) * buckets.capacity() + sizeof(uint64_t) * counts.capacity();
+
+  for (size_t i = 0; i < dimensions.size(); i++) {
+    sum += dimensions[i].capacity() + sizeof(uint32_t) * dimensionIds[i].capacity();
+    for (auto &&value : dimensionValues[i]) {
+      sum += sizeof(string) + value.capacity();
+      // index keeps another copy of every value
+      sum += MAP_NODE_OVERHEAD + sizeof(pair<string, uint32_t>) + value.capacity();
+    }
+  }
+
+  for (size_t i = 0; i < metrics.size(); i++) {
+    sum += sizeof(RollupMetric) + metrics[i].field.capacity() + sizeof(uint64_t) * metricValues[i].capacity();
+    sum += sizeof(HyperLogLog) * metricSketches[i].capacity();
+    for (auto &&sketch : metricSketches[i]) {
+      sum += sketch.statUsedMemory();
+    }
+  }
+
+  sum += (MAP_NODE_OVERHEAD + sizeof(pair<string, uint32_t>) + keySize) * rowIndex.size();
+
+  return sum;
+}
+
+void Rollup::save(SnapshotWriter &writer) const {
+  writer.writeString(name);
+  writer.writeString(timeField);
+  writer.writeValue(granularity);
+  writer.writeValue((uint64_t) dimensions.size());
+
+  for (auto &&dimension : dimensions) {
+    writer.writeString(dimension);
+  }
+
+  writer.writeValue((uint64_t) metrics.size());
+
+  for (auto &&metric : metrics) {
+    writer.writeString(metric.field);
+    writer.writeString(metric.func);
+    writer.writeValue((int32_t) metric.type);
+  }
+
+  writer.writeVector(buckets);
+  writer.writeVector(counts);
+
+  for (size_t i = 0; i < dimensions.size(); i++) {
+    writer.writeVector(dimensionIds[i]);
+    writer.writeValue((uint64_t) dimensionValues[i].size());
+    for (auto &&value : dimensionValues[i]) {
+      writer.writeString(value);
+    }
+  }
+
+  for (size_t i = 0; i < metrics.size(); i++) {
+    writer.writeVector(metricValues[i]);
+    writer.writeValue((uint64_t) metricSketches[i].size());
+    for (auto &&sketch : metricSketches[i]) {
+      writer.writeVector(sketch.registers);
+    }
+  }
+}
+
+Rollup *Rollup::load(SnapshotReader &reader) {
+  const auto name = reader.readString();
+  const auto timeField = reader.readString();
+  const auto granularity = reader.readValue<int64_t>();
+  vector<string> dimensions(reader.readValue<uint64_t>());
+
+  for (auto &&dimension : dimensions) {
+    dimension = reader.readString();
+  }
+
+  vector<RollupMetric> metrics(reader.readValue<uint64_t>());
+
+  for (auto &&metric : metrics) {
+    metric.field = reader.readString();
+    metric.func = reader.readString();
+    metric.type = reader.readValue<int32_t>();
+  }
+
+  auto rollup = new Rollup(name, timeField, granularity, dimensions, metrics);
+
+  try {
+    reader.readVector(rollup->buckets);
+    reader.readVector(rollup->counts);
+
+    for (size_t i = 0; i < dimensions.size(); i++) {
+      reader.readVector(rollup->dimensionIds[i]);
+      rollup->dimensionValues[i].resize(reader.readValue<uint64_t>());
+      for (auto &&value : rollup->dimensionValues[i]) {
+        value = reader.readString();
+      }
+    }
+
+    for (size_t i = 0; i < metrics.size(); i++) {
+      reader.readVector(rollup->metricValues[i]);
+      rollup->metricSketches[i].resize(reader.readValue<uint64_t>());
+      for (auto &&sketch : rollup->metricSketches[i]) {
+        reader.readVector(sketch.registers);
+      }
+    }
+
+    const auto rows = rollup->counts.size();
+    bool valid = rollup->buckets.size() == rows;
+
+    for (size_t i = 0; i < dimensions.size(); i++) {
+      valid = valid && rollup->dimensionIds[i].size() == rows;
+      for (auto &&id : rollup->dimensionIds[i]) {
+        valid = valid && id < rollup->dimensionValues[i].size();
+      }
+    }
+
+    for (size_t i = 0; i < metrics.size(); i++) {
+      const bool sketches = rollup->isSketch(i);
+      valid = valid && rollup->metricValues[i].size() == (sketches ? 0 : rows) && rollup->metricSketches[i].size() == (sketches ? rows : 0);
+      for (auto &&sketch : rollup->metricSketches[i]) {
+        valid = valid && (sketch.registers.empty() || sketch.registers.size() == HLL_REGISTERS);
+      }
+    }
+
+    if (!valid) {
+      throw std::runtime_error("rollup " + name + " is corrupted");
+    }
+
+    rollup->rebuildIndex();
+  } catch (...) {
+    delete rollup;
+    throw;
+  }
+
+  return rollup;
+}
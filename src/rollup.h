@@ -0,0 +1,89 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "generic-value.h"
+#include "hyperloglog.h"
+#include "snapshot.h"
+
+#ifndef MERLIN_ROLLUP_H
+#define MERLIN_ROLLUP_H
+
+using namespace std;
+
+class InsertBatch;
+
+// aggregation kept up to date by a rollup, count is always kept
+struct RollupMetric {
+  string field;
+  string func; // sum, min, max or approx_count_distinct
+  int type;    // type of the field
+};
+
+// pre-aggregated form of a table: one row per time bucket and
+// combination of dimension values, holding row count and metrics.
+// updated by every insert batch, queries it covers read it instead of rows.
+class Rollup {
+  public:
+  string name;
+  string timeField;
+  int64_t granularity;
+  // dict encoded string or boolean fields
+  vector<string> dimensions;
+  vector<RollupMetric> metrics;
+
+  // bucket start of each row
+  vector<int64_t> buckets;
+  // per dimension: value id of each row and values by id
+  vector<vector<uint32_t>> dimensionIds;
+  vector<vector<string>> dimensionValues;
+  vector<uint64_t> counts;
+  // per metric: value of each row. int metrics are kept sign extended.
+  vector<vector<uint64_t>> metricValues;
+  // per metric: sketch of each row, for approx_count_distinct metrics.
+  // every sketch takes HLL_REGISTERS bytes, so these suit coarse rollups best.
+  vector<vector<HyperLogLog>> metricSketches;
+
+  Rollup(const string &name_, const string &timeField_, int64_t granularity_, const vector<string> &dimensions_, const vector<RollupMetric> &metrics_);
+
+  size_t size() const {
+    return counts.size();
+  }
+
+  // index of a dimension or -1
+  int findDimension(const string &field) const;
+
+  // index of a metric or -1
+  int findMetric(const string &field, const string &func) const;
+
+  // whether a metric keeps sketches instead of values
+  bool isSketch(size_t metric) const {
+    return metrics[metric].func == "approx_count_distinct";
+  }
+
+  // folds rows of a batch holding every field of the table
+  void add(const InsertBatch &batch);
+
+  // removes buckets ending before given time
+  void dropBefore(int64_t time);
+
+  int64_t statUsedMemory() const;
+
+  void save(SnapshotWriter &writer) const;
+  static Rollup *load(SnapshotReader &reader);
+
+  private:
+  // encoded bucket and dimension ids > row
+  unordered_map<string, uint32_t> rowIndex;
+  // per dimension: value > id
+  vector<unordered_map<string, uint32_t>> dimensionIndex;
+
+  uint32_t dimensionId(size_t dimension, const string &value);
+  string rowKey(int64_t bucket, const uint32_t *ids) const;
+  void rebuildIndex();
+};
+
+// key of a dimension value in rollups and query groups
+string rollupDimensionValue(const GenericValueContainer &value);
+
+#endif //MERLIN_ROLLUP_H
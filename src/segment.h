@@ -0,0 +1,106 @@
+#include <string>
+#include <map>
+#include <stdint.h>
+
+#include "field.h"
+#include "utils.h"
+
+#ifndef MERLIN_SEGMENT_H
+#define MERLIN_SEGMENT_H
+
+using namespace std;
+
+// rows per segment. row ids of a segment start from 1, so this many rows
+// fill exactly 16 roaring containers and 16 packed column blocks.
+const uint32_t SEGMENT_ROWS = (1 << 20) - 1;
+
+// a range of table rows with its own fields, row ids are local to the segment.
+// rows are appended to the head segment of a table only. once full it is
+// sealed: its storage is compacted and never written again.
+class Segment {
+  public:
+  map<string, Field *> fields;
+  uint32_t size = 0; // record count
+  bool sealed = false;
+  // start of the time partition the rows belong to, 0 for tables without partitions
+  int64_t partition = 0;
+  // statUsedMemory of a sealed segment, measured once as it never changes after
+  int64_t sealedMemory = 0;
+
+  Segment() {}
+
+  Segment(const Segment &) = delete;
+  Segment &operator=(const Segment &) = delete;
+
+  ~Segment() {
+    for (auto &&it : fields) {
+      delete it.second;
+    }
+  }
+
+  void setField(Field *field) {
+    fields[field->name] = field;
+  }
+
+  // memory owned by the segment and its fields
+  int64_t statUsedMemory() {
+    int64_t sum = sizeof(Segment);
+
+    for (auto &&it : fields) {
+      sum += MAP_NODE_OVERHEAD + sizeof(it) + it.first.capacity() + it.second->statUsedMemory();
+    }
+
+    return sum;
+  }
+
+  // compacts every field, returns reclaimed bytes
+  int64_t compact() {
+    int64_t reclaimed = 0;
+
+    for (auto &&it : fields) {
+      reclaimed += it.second->compact();
+    }
+
+    return reclaimed;
+  }
+
+  // builds the final encodings of a full segment in place, returns reclaimed bytes
+  int64_t seal() {
+    const auto reclaimed = compact();
+    sealed = true;
+    sealedMemory = statUsedMemory();
+    return reclaimed;
+  }
+
+  // sealed copy of a full segment. the segment is only read,
+  // so queries may run on it while the copy is built.
+  Segment *sealedCopy() const {
+    auto segment = new Segment();
+    segment->size = size;
+    segment->partition = partition;
+    segment->sealed = true;
+
+    for (auto &&it : fields) {
+      auto field = it.second->clone();
+      field->compact();
+      segment->setField(field);
+    }
+
+    segment->sealedMemory = segment->statUsedMemory();
+
+    return segment;
+  }
+
+  // whether some field reads from a snapshot file
+  bool isMapped() const {
+    for (auto &&it : fields) {
+      if (it.second->mapping) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+};
+
+#endif //MERLIN_SEGMENT_H
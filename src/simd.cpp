@@ -0,0 +1,178 @@
+#include <string.h>
+#include "simd.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define MERLIN_HAVE_AVX2_DISPATCH 1
+#  include <immintrin.h>
+#endif
+
+static size_t rangePrefixLengthScalar(const int64_t *values, size_t count, int64_t lo, int64_t hi) {
+  size_t i = 0;
+
+  while (i < count && values[i] >= lo && values[i] < hi) {
+    i++;
+  }
+
+  return i;
+}
+
+static void unpackGatherScalar(const uint8_t *packed, int width, int64_t base,
+                               const uint32_t *positions, uint32_t positionMask, size_t count, int64_t *out) {
+  const uint64_t mask = (1ULL << width) - 1;
+
+  for (size_t i = 0; i < count; i++) {
+    const uint64_t bit = (uint64_t) (positions[i] & positionMask) * width;
+    uint64_t word;
+    memcpy(&word, packed + (bit >> 3), sizeof(word));
+    out[i] = base + (int64_t) ((word >> (bit & 7)) & mask);
+  }
+}
+
+// min and max compare values xor bias, a bias of the sign bit compares them unsigned.
+// min and max are kept biased.
+static void aggregateScalar(const int64_t *values, size_t count, int64_t bias, int64_t *min, int64_t *max, uint64_t *sum) {
+  for (size_t i = 0; i < count; i++) {
+    const int64_t value = values[i] ^ bias;
+    *min = value < *min ? value : *min;
+    *max = value > *max ? value : *max;
+    *sum += (uint64_t) values[i];
+  }
+}
+
+#ifdef MERLIN_HAVE_AVX2_DISPATCH
+
+__attribute__((target("avx2")))
+static size_t rangePrefixLengthAvx2(const int64_t *values, size_t count, int64_t lo, int64_t hi) {
+  const __m256i vlo = _mm256_set1_epi64x(lo);
+  const __m256i vhi = _mm256_set1_epi64x(hi);
+  size_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *) (values + i));
+    // in range: !(lo > v) && (hi > v)
+    const __m256i inRange = _mm256_andnot_si256(_mm256_cmpgt_epi64(vlo, v), _mm256_cmpgt_epi64(vhi, v));
+    const int mask = _mm256_movemask_pd(_mm256_castsi256_pd(inRange));
+
+    if (mask != 0xF) {
+      return i + __builtin_ctz(~mask);
+    }
+  }
+
+  return i + rangePrefixLengthScalar(values + i, count - i, lo, hi);
+}
+
+__attribute__((target("avx2")))
+static void unpackGatherAvx2(const uint8_t *packed, int width, int64_t base,
+                             const uint32_t *positions, uint32_t positionMask, size_t count, int64_t *out) {
+  const __m128i vpositionMask = _mm_set1_epi32((int) positionMask);
+  const __m256i vwidth = _mm256_set1_epi64x(width);
+  const __m256i vmask = _mm256_set1_epi64x((long long) ((1ULL << width) - 1));
+  const __m256i vbase = _mm256_set1_epi64x(base);
+  const __m256i seven = _mm256_set1_epi64x(7);
+  size_t i = 0;
+
+  // 4 values per step: bit offset = position * width,
+  // load 8 bytes at bit offset / 8, shift out bit offset % 8 and mask.
+  for (; i + 4 <= count; i += 4) {
+    const __m128i pos = _mm_and_si128(_mm_loadu_si128((const __m128i *) (positions + i)), vpositionMask);
+    const __m256i bit = _mm256_mul_epu32(_mm256_cvtepu32_epi64(pos), vwidth);
+    const __m256i words = _mm256_i64gather_epi64((const long long *) packed, _mm256_srli_epi64(bit, 3), 1);
+    const __m256i values = _mm256_and_si256(_mm256_srlv_epi64(words, _mm256_and_si256(bit, seven)), vmask);
+    _mm256_storeu_si256((__m256i *) (out + i), _mm256_add_epi64(values, vbase));
+  }
+
+  unpackGatherScalar(packed, width, base, positions + i, positionMask, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void aggregateAvx2(const int64_t *values, size_t count, int64_t bias, int64_t *min, int64_t *max, uint64_t *sum) {
+  const __m256i vbias = _mm256_set1_epi64x(bias);
+  __m256i vmin = _mm256_set1_epi64x(*min);
+  __m256i vmax = _mm256_set1_epi64x(*max);
+  __m256i vsum = _mm256_setzero_si256();
+  size_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *) (values + i));
+    const __m256i biased = _mm256_xor_si256(v, vbias);
+    vmin = _mm256_blendv_epi8(vmin, biased, _mm256_cmpgt_epi64(vmin, biased));
+    vmax = _mm256_blendv_epi8(vmax, biased, _mm256_cmpgt_epi64(biased, vmax));
+    vsum = _mm256_add_epi64(vsum, v);
+  }
+
+  int64_t mins[4];
+  int64_t maxs[4];
+  uint64_t sums[4];
+  _mm256_storeu_si256((__m256i *) mins, vmin);
+  _mm256_storeu_si256((__m256i *) maxs, vmax);
+  _mm256_storeu_si256((__m256i *) sums, vsum);
+
+  for (int lane = 0; lane < 4; lane++) {
+    *min = mins[lane] < *min ? mins[lane] : *min;
+    *max = maxs[lane] > *max ? maxs[lane] : *max;
+    *sum += sums[lane];
+  }
+
+  aggregateScalar(values + i, count - i, bias, min, max, sum);
+}
+
+static bool cpuHasAvx2() {
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+  return hasAvx2;
+}
+
+#endif
+
+size_t simdRangePrefixLength(const int64_t *values, size_t count, int64_t lo, int64_t hi) {
+#ifdef MERLIN_HAVE_AVX2_DISPATCH
+  if (cpuHasAvx2()) {
+    return rangePrefixLengthAvx2(values, count, lo, hi);
+  }
+#endif
+
+  return rangePrefixLengthScalar(values, count, lo, hi);
+}
+
+void simdUnpackGather(const uint8_t *packed, int width, int64_t base,
+                      const uint32_t *positions, uint32_t positionMask, size_t count, int64_t *out) {
+#ifdef MERLIN_HAVE_AVX2_DISPATCH
+  if (cpuHasAvx2()) {
+    unpackGatherAvx2(packed, width, base, positions, positionMask, count, out);
+    return;
+  }
+#endif
+
+  unpackGatherScalar(packed, width, base, positions, positionMask, count, out);
+}
+
+static void aggregate(const int64_t *values, size_t count, int64_t bias, int64_t *min, int64_t *max, uint64_t *sum) {
+  int64_t biasedMin = *min ^ bias;
+  int64_t biasedMax = *max ^ bias;
+
+#ifdef MERLIN_HAVE_AVX2_DISPATCH
+  if (cpuHasAvx2()) {
+    aggregateAvx2(values, count, bias, &biasedMin, &biasedMax, sum);
+  } else {
+    aggregateScalar(values, count, bias, &biasedMin, &biasedMax, sum);
+  }
+#else
+  aggregateScalar(values, count, bias, &biasedMin, &biasedMax, sum);
+#endif
+
+  *min = biasedMin ^ bias;
+  *max = biasedMax ^ bias;
+}
+
+void simdAggregate(const int64_t *values, size_t count, int64_t *min, int64_t *max, uint64_t *sum) {
+  aggregate(values, count, 0, min, max, sum);
+}
+
+void simdAggregateUnsigned(const uint64_t *values, size_t count, uint64_t *min, uint64_t *max, uint64_t *sum) {
+  int64_t signedMin = (int64_t) *min;
+  int64_t signedMax = (int64_t) *max;
+
+  aggregate((const int64_t *) values, count, INT64_MIN, &signedMin, &signedMax, sum);
+
+  *min = (uint64_t) signedMin;
+  *max = (uint64_t) signedMax;
+}
@@ -0,0 +1,25 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MERLIN_SIMD_H
+#define MERLIN_SIMD_H
+
+// vectorized helpers for hot loops. every function has an AVX2 version
+// chosen at runtime when the cpu supports it, and a scalar fallback.
+
+// returns the length of the prefix of values which are in [lo, hi)
+size_t simdRangePrefixLength(const int64_t *values, size_t count, int64_t lo, int64_t hi);
+
+// decodes values of a bit packed block: out[i] = base + value at (positions[i] & positionMask).
+// width must be <= 56 and packed must have 8 bytes of padding after the last value.
+void simdUnpackGather(const uint8_t *packed, int width, int64_t base,
+                      const uint32_t *positions, uint32_t positionMask, size_t count, int64_t *out);
+
+// folds values into min, max and sum, which hold the aggregates of earlier batches.
+// sum wraps around like unsigned addition.
+void simdAggregate(const int64_t *values, size_t count, int64_t *min, int64_t *max, uint64_t *sum);
+
+// same as simdAggregate, comparing values as unsigned
+void simdAggregateUnsigned(const uint64_t *values, size_t count, uint64_t *min, uint64_t *max, uint64_t *sum);
+
+#endif //MERLIN_SIMD_H
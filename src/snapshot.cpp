@@ -0,0 +1,422 @@
+#include <stdexcept>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "table.h"
+
+using namespace std;
+
+// "MSNP" followed by format version
+static const uint32_t SNAPSHOT_MAGIC = 0x504e534d;
+static const uint32_t SNAPSHOT_VERSION = 6;
+static const size_t SNAPSHOT_IO_BUFFER_SIZE = 1 << 20;
+
+SnapshotWriter::SnapshotWriter(const string &path_): path(path_), offset(0), buffer(SNAPSHOT_IO_BUFFER_SIZE) {
+  file = fopen((path + ".tmp").c_str(), "wb");
+
+  if (file == nullptr) {
+    throw std::runtime_error("could not create " + path + ".tmp: " + strerror(errno));
+  }
+
+  setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  // not committed, drop the partial file
+  if (file != nullptr) {
+    fclose(file);
+    remove((path + ".tmp").c_str());
+  }
+}
+
+void SnapshotWriter::write(const void *data, size_t size) {
+  if (size > 0 && fwrite(data, 1, size, file) != size) {
+    throw std::runtime_error("could not write " + path + ": " + strerror(errno));
+  }
+
+  offset += size;
+}
+
+void SnapshotWriter::align(size_t alignment) {
+  static const char zeros[SNAPSHOT_BITMAP_ALIGNMENT] = {0};
+  write(zeros, (alignment - offset % alignment) % alignment);
+}
+
+void SnapshotWriter::writeString(const string &value) {
+  writeValue((uint64_t) value.size());
+  write(value.data(), value.size());
+}
+
+void SnapshotWriter::writeBitmap(const roaring_bitmap_t *bitmap) {
+  vector<char> serialized(roaring_bitmap_frozen_size_in_bytes(bitmap));
+  roaring_bitmap_frozen_serialize(bitmap, serialized.data());
+  writeValue((uint64_t) serialized.size());
+  align(SNAPSHOT_BITMAP_ALIGNMENT);
+  write(serialized.data(), serialized.size());
+}
+
+void SnapshotWriter::commit() {
+  const bool flushed = fflush(file) == 0 && fsync(fileno(file)) == 0;
+  fclose(file);
+  file = nullptr;
+
+  if (!flushed || rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+    const string err = strerror(errno);
+    remove((path + ".tmp").c_str());
+    throw std::runtime_error("could not save " + path + ": " + err);
+  }
+}
+
+MappedFile::MappedFile(const string &path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    const string err = strerror(errno);
+    if (fd >= 0) {
+      close(fd);
+    }
+    throw std::runtime_error("could not open " + path + ": " + err);
+  }
+
+  size = (size_t) st.st_size;
+  data = nullptr;
+
+  if (size > 0) {
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+      const string err = strerror(errno);
+      close(fd);
+      throw std::runtime_error("could not map " + path + ": " + err);
+    }
+    data = (const char *) mapped;
+  }
+
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data != nullptr) {
+    munmap((void *) data, size);
+  }
+}
+
+SnapshotReader::SnapshotReader(const string &path_, bool zeroCopy_): path(path_), position(0), zeroCopy(zeroCopy_) {
+  file = make_shared<MappedFile>(path);
+}
+
+const char *SnapshotReader::view(size_t size) {
+  if (size > file->size - position) {
+    throw std::runtime_error("unexpected end of " + path);
+  }
+
+  const char *result = file->data + position;
+  position += size;
+
+  return result;
+}
+
+void SnapshotReader::align(size_t alignment) {
+  view((alignment - position % alignment) % alignment);
+}
+
+string SnapshotReader::readString() {
+  const auto size = readValue<uint64_t>();
+  return string(view(size), size);
+}
+
+roaring_bitmap_t *SnapshotReader::readBitmap() {
+  const auto size = readValue<uint64_t>();
+  align(SNAPSHOT_BITMAP_ALIGNMENT);
+
+  auto bitmap = (roaring_bitmap_t *) roaring_bitmap_frozen_view(view(size), size);
+
+  if (bitmap == nullptr) {
+    throw std::runtime_error("corrupt bitmap in " + path);
+  }
+
+  if (!zeroCopy) {
+    auto copy = roaring_bitmap_copy(bitmap);
+    roaring_bitmap_free(bitmap);
+    return copy;
+  }
+
+  return bitmap;
+}
+
+// table and field names may contain any character, file names use their hex form
+static string hexName(const string &name) {
+  static const char digits[] = "0123456789abcdef";
+  string result;
+
+  for (auto &&c : name) {
+    result += digits[(uint8_t) c >> 4];
+    result += digits[(uint8_t) c & 0xf];
+  }
+
+  return result;
+}
+
+struct SnapshotSegmentMeta {
+  uint32_t size;
+  bool sealed;
+  int64_t partition;
+  // field files relative to snapshot dir
+  vector<string> files;
+};
+
+struct SnapshotTableMeta {
+  string name;
+  string partitionField;
+  int64_t partitionSeconds;
+  int64_t retentionSeconds;
+  // empty fields, a partitioned table may have no segments to take them from
+  vector<shared_ptr<Field>> definitions;
+  vector<SnapshotSegmentMeta> segments;
+  // rollup files relative to snapshot dir
+  vector<string> rollups;
+};
+
+// snapshot.meta lists tables and their field files.
+// it is replaced last, so it always points to a complete snapshot.
+static bool readSnapshotMeta(const string &dir, uint64_t *generation, uint64_t *walSequence, vector<SnapshotTableMeta> &tables) {
+  struct stat st;
+
+  if (stat((dir + "/snapshot.meta").c_str(), &st) != 0) {
+    return false;
+  }
+
+  SnapshotReader reader(dir + "/snapshot.meta");
+
+  if (reader.readValue<uint32_t>() != SNAPSHOT_MAGIC) {
+    throw std::runtime_error("unsupported snapshot in " + dir);
+  }
+
+  if (reader.readValue<uint32_t>() != SNAPSHOT_VERSION) {
+    throw std::runtime_error("unsupported snapshot in " + dir);
+  }
+
+  *generation = reader.readValue<uint64_t>();
+  *walSequence = reader.readValue<uint64_t>();
+  tables.resize(reader.readValue<uint64_t>());
+
+  for (auto &&table : tables) {
+    table.name = reader.readString();
+    table.partitionField = reader.readString();
+    table.partitionSeconds = reader.readValue<int64_t>();
+    table.retentionSeconds = reader.readValue<int64_t>();
+    table.definitions.resize(reader.readValue<uint64_t>());
+
+    for (auto &&definition : table.definitions) {
+      definition.reset(Field::load(reader));
+    }
+
+    table.segments.resize(reader.readValue<uint64_t>());
+
+    for (auto &&segment : table.segments) {
+      segment.size = reader.readValue<uint32_t>();
+      segment.sealed = reader.readValue<uint8_t>() != 0;
+      segment.partition = reader.readValue<int64_t>();
+      segment.files.resize(reader.readValue<uint64_t>());
+      for (auto &&file : segment.files) {
+        file = reader.readString();
+      }
+    }
+
+    table.rollups.resize(reader.readValue<uint64_t>());
+
+    for (auto &&file : table.rollups) {
+      file = reader.readString();
+    }
+  }
+
+  return true;
+}
+
+static void makeDir(const string &dir) {
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    throw std::runtime_error("could not create " + dir + ": " + strerror(errno));
+  }
+}
+
+void saveSnapshot(const string &dir, const map<string, Table *> &tables, uint64_t walSequence) {
+  uint64_t generation = 0;
+  uint64_t previousWalSequence = 0;
+  vector<SnapshotTableMeta> previous;
+  vector<SnapshotTableMeta> current;
+
+  makeDir(dir);
+  readSnapshotMeta(dir, &generation, &previousWalSequence, previous);
+
+  // every snapshot goes into a new generation directory,
+  // files of the previous one are removed after the meta file points to the new one.
+  generation++;
+  const string generationDir = to_string(generation);
+  makeDir(dir + "/" + generationDir);
+
+  for (auto &&it : tables) {
+    SnapshotTableMeta meta;
+    meta.name = it.first;
+
+    const auto segments = it.second->allSegments();
+
+    for (size_t i = 0; i < segments.size(); i++) {
+      const auto segment = segments[i];
+      SnapshotSegmentMeta segmentMeta;
+      segmentMeta.size = segment->size;
+      segmentMeta.sealed = segment->sealed;
+      segmentMeta.partition = segment->partition;
+
+      for (auto &&fieldIt : segment->fields) {
+        const auto file = generationDir + "/" + hexName(it.first) + "-" + to_string(i) + "-" + hexName(fieldIt.first) + ".col";
+        SnapshotWriter writer(dir + "/" + file);
+        fieldIt.second->save(writer);
+        writer.commit();
+        segmentMeta.files.push_back(file);
+      }
+
+      meta.segments.push_back(segmentMeta);
+    }
+
+    for (auto &&rollup : it.second->rollups) {
+      const auto file = generationDir + "/" + hexName(it.first) + "-" + hexName(rollup->name) + ".rollup";
+      SnapshotWriter writer(dir + "/" + file);
+      rollup->save(writer);
+      writer.commit();
+      meta.rollups.push_back(file);
+    }
+
+    current.push_back(meta);
+  }
+
+  SnapshotWriter writer(dir + "/snapshot.meta");
+  writer.writeValue(SNAPSHOT_MAGIC);
+  writer.writeValue(SNAPSHOT_VERSION);
+  writer.writeValue(generation);
+  writer.writeValue(walSequence);
+  writer.writeValue((uint64_t) current.size());
+
+  for (auto &&table : current) {
+    const auto source = tables.at(table.name);
+    writer.writeString(table.name);
+    writer.writeString(source->partitionField);
+    writer.writeValue(source->partitionSeconds);
+    writer.writeValue(source->retentionSeconds);
+    writer.writeValue((uint64_t) source->fields.size());
+
+    for (auto &&fieldIt : source->fields) {
+      fieldIt.second->save(writer);
+    }
+
+    writer.writeValue((uint64_t) table.segments.size());
+
+    for (auto &&segment : table.segments) {
+      writer.writeValue(segment.size);
+      writer.writeValue((uint8_t) segment.sealed);
+      writer.writeValue(segment.partition);
+      writer.writeValue((uint64_t) segment.files.size());
+      for (auto &&file : segment.files) {
+        writer.writeString(file);
+      }
+    }
+
+    writer.writeValue((uint64_t) table.rollups.size());
+
+    for (auto &&file : table.rollups) {
+      writer.writeString(file);
+    }
+  }
+
+  writer.commit();
+
+  for (auto &&table : previous) {
+    for (auto &&segment : table.segments) {
+      for (auto &&file : segment.files) {
+        remove((dir + "/" + file).c_str());
+      }
+    }
+
+    for (auto &&file : table.rollups) {
+      remove((dir + "/" + file).c_str());
+    }
+  }
+
+  if (generation > 1) {
+    rmdir((dir + "/" + to_string(generation - 1)).c_str());
+  }
+}
+
+void loadSnapshot(const string &dir, map<string, Table *> &tables, bool zeroCopy, uint64_t *walSequence) {
+  uint64_t generation;
+  uint64_t sequence;
+  vector<SnapshotTableMeta> metas;
+
+  if (!readSnapshotMeta(dir, &generation, &sequence, metas)) {
+    return;
+  }
+
+  for (auto &&meta : metas) {
+    vector<Segment *> segments;
+    Table *table = nullptr;
+
+    try {
+      for (auto &&segmentMeta : meta.segments) {
+        segments.push_back(new Segment());
+        auto segment = segments.back();
+        segment->size = segmentMeta.size;
+        segment->sealed = segmentMeta.sealed;
+        segment->partition = segmentMeta.partition;
+
+        for (auto &&file : segmentMeta.files) {
+          SnapshotReader reader(dir + "/" + file, zeroCopy);
+          auto field = Field::load(reader);
+          segment->setField(field);
+
+          if ((uint32_t) field->size != segmentMeta.size) {
+            throw std::runtime_error("row count of field " + field->name + " does not match table " + meta.name);
+          }
+        }
+
+        if (segment->fields.size() != segments.front()->fields.size()) {
+          throw std::runtime_error("segments of table " + meta.name + " have different fields");
+        }
+      }
+
+      table = new Table();
+
+      for (auto &&definition : meta.definitions) {
+        table->setField(definition->cloneDefinition());
+      }
+
+      if (meta.partitionSeconds > 0) {
+        table->setPartitioning(meta.partitionField, meta.partitionSeconds);
+      }
+
+      for (auto &&file : meta.rollups) {
+        SnapshotReader reader(dir + "/" + file);
+        table->addRollup(Rollup::load(reader));
+      }
+    } catch (...) {
+      delete table;
+      for (auto &&segment : segments) {
+        delete segment;
+      }
+      throw;
+    }
+
+    table->retentionSeconds = meta.retentionSeconds;
+    table->setSegments(segments);
+
+    delete tables[meta.name];
+    tables[meta.name] = table;
+  }
+
+  if (walSequence != nullptr) {
+    *walSequence = sequence;
+  }
+}
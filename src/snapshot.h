@@ -0,0 +1,164 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "roaring/roaring.h"
+
+#ifndef MERLIN_SNAPSHOT_H
+#define MERLIN_SNAPSHOT_H
+
+using namespace std;
+
+class Table;
+
+// vectors start at multiples of this offset in snapshot files,
+// so mapped arrays can be used in place
+const size_t SNAPSHOT_VECTOR_ALIGNMENT = 8;
+// roaring_bitmap_frozen_view requires 32 byte aligned buffers
+const size_t SNAPSHOT_BITMAP_ALIGNMENT = 32;
+
+// writes a snapshot file. data goes to "<path>.tmp" which
+// replaces path on commit, so a crash never leaves a torn file behind.
+// numbers are written in host byte order, which is little endian
+// on every platform we run on.
+class SnapshotWriter {
+  public:
+  SnapshotWriter(const string &path_);
+  ~SnapshotWriter();
+
+  SnapshotWriter(const SnapshotWriter &) = delete;
+  SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+  void write(const void *data, size_t size);
+
+  // pads file with zeros up to a multiple of alignment
+  void align(size_t alignment);
+
+  template <typename T>
+  void writeValue(T value) {
+    write(&value, sizeof(value));
+  }
+
+  // element count followed by raw elements
+  template <typename T>
+  void writeVector(const vector<T> &values) {
+    writeArray(values.data(), values.size());
+  }
+
+  template <typename T>
+  void writeArray(const T *values, size_t count) {
+    writeValue((uint64_t) count);
+    align(SNAPSHOT_VECTOR_ALIGNMENT);
+    write(values, sizeof(T) * count);
+  }
+
+  void writeString(const string &value);
+
+  // roaring frozen format, prefixed with its length
+  void writeBitmap(const roaring_bitmap_t *bitmap);
+
+  // flushes the file to disk and moves it into place
+  void commit();
+
+  private:
+  string path;
+  FILE *file;
+  uint64_t offset;
+  vector<char> buffer;
+};
+
+// read only mapping of a whole file
+class MappedFile {
+  public:
+  const char *data;
+  size_t size;
+
+  MappedFile(const string &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+};
+
+// reads a snapshot file through a mapping.
+// in zero copy mode bitmaps are frozen views and arrays are pointers into
+// the mapping, so whoever keeps them must also keep mapping() alive.
+class SnapshotReader {
+  public:
+  SnapshotReader(const string &path, bool zeroCopy_ = false);
+
+  SnapshotReader(const SnapshotReader &) = delete;
+  SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+  bool isZeroCopy() const {
+    return zeroCopy;
+  }
+
+  const shared_ptr<MappedFile> &mapping() const {
+    return file;
+  }
+
+  // returns next size bytes of the file in place
+  const char *view(size_t size);
+
+  void align(size_t alignment);
+
+  void read(void *data, size_t size) {
+    memcpy(data, view(size), size);
+  }
+
+  template <typename T>
+  T readValue() {
+    T value;
+    read(&value, sizeof(value));
+    return value;
+  }
+
+  template <typename T>
+  void readVector(vector<T> &values) {
+    uint64_t count;
+    const T *array = viewArray<T>(&count);
+    values.assign(array, array + count);
+  }
+
+  // array written by writeVector/writeArray, in place
+  template <typename T>
+  const T *viewArray(uint64_t *count) {
+    *count = readValue<uint64_t>();
+    align(SNAPSHOT_VECTOR_ALIGNMENT);
+
+    if (*count > (file->size - position) / sizeof(T)) {
+      throw std::runtime_error("unexpected end of " + path);
+    }
+
+    return (const T *) view(sizeof(T) * *count);
+  }
+
+  string readString();
+
+  // frozen view in zero copy mode, an owned copy otherwise.
+  // caller frees the returned bitmap either way.
+  roaring_bitmap_t *readBitmap();
+
+  private:
+  string path;
+  shared_ptr<MappedFile> file;
+  size_t position;
+  bool zeroCopy;
+};
+
+// writes every table under dir, one file per field.
+// walSequence is the last write ahead log record the tables contain.
+void saveSnapshot(const string &dir, const map<string, Table *> &tables, uint64_t walSequence = 0);
+
+// loads tables written by saveSnapshot. does nothing when dir has no snapshot.
+// with zeroCopy, sealed data is used straight from the mapped files and
+// fields are copied into memory only when they are written to.
+// walSequence receives the sequence given to saveSnapshot.
+void loadSnapshot(const string &dir, map<string, Table *> &tables, bool zeroCopy = false, uint64_t *walSequence = nullptr);
+
+#endif //MERLIN_SNAPSHOT_H
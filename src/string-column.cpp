@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include "string-column.h"
+
+using namespace std;
+
+roaring_bitmap_t *StringColumn::match(const string &op, const string &value) const {
+  const char *data = arenaData;
+  const size_t len = value.size();
+  vector<uint32_t> rows;
+
+  if (op == "=" || op == "!=") {
+    const bool equal = op == "=";
+
+    for (uint32_t i = 0, count = (uint32_t) size(); i < count; i++) {
+      const bool matches = offsetsData[i + 1] - offsetsData[i] == len && memcmp(data + offsetsData[i], value.data(), len) == 0;
+      if (matches == equal) {
+        rows.push_back(i + 1);
+      }
+    }
+  } else if (op == "prefix") {
+    for (uint32_t i = 0, count = (uint32_t) size(); i < count; i++) {
+      if (offsetsData[i + 1] - offsetsData[i] >= len && memcmp(data + offsetsData[i], value.data(), len) == 0) {
+        rows.push_back(i + 1);
+      }
+    }
+  } else if (op == "contains") {
+    if (len == 0) {
+      return roaring_bitmap_from_range(1, (uint64_t) size() + 1, 1);
+    }
+    findSubstring(value, rows);
+  } else {
+    throw std::runtime_error("unsupported operator for raw string field: " + op);
+  }
+
+  return roaring_bitmap_of_ptr(rows.size(), rows.data());
+}
+
+void StringColumn::findSubstring(const string &value, vector<uint32_t> &rows) const {
+  // search the whole arena at once, memchr finds candidate first bytes
+  // with vector instructions. a match is mapped back to its row via offsets.
+  const char *begin = arenaData;
+  const char *end = begin + arenaSize;
+  const size_t len = value.size();
+  size_t row = 0;
+
+  for (const char *p = begin; end - p >= (ptrdiff_t) len; ) {
+    p = (const char *) memchr(p, value[0], end - p - len + 1);
+
+    if (p == nullptr) {
+      break;
+    }
+
+    if (memcmp(p + 1, value.data() + 1, len - 1) != 0) {
+      p++;
+      continue;
+    }
+
+    const uint64_t position = p - begin;
+    row = std::upper_bound(offsetsData + row, offsetsData + offsetCount, position) - offsetsData - 1;
+
+    // a match crossing into the next row means later ones in this row cross too
+    if (position + len <= offsetsData[row + 1]) {
+      rows.push_back((uint32_t) row + 1);
+    }
+
+    p = begin + offsetsData[row + 1];
+  }
+}
+
+void StringColumn::load(SnapshotReader &reader) {
+  if (reader.isZeroCopy()) {
+    arenaData = reader.viewArray<char>(&arenaSize);
+    offsetsData = reader.viewArray<uint64_t>(&offsetCount);
+    mapping = reader.mapping();
+  } else {
+    reader.readVector(arena);
+    reader.readVector(offsets);
+    refresh();
+  }
+
+  if (offsetCount == 0) {
+    throw std::runtime_error("corrupt string column");
+  }
+}
+
+void StringColumn::thaw() {
+  arena.assign(arenaData, arenaData + arenaSize);
+  offsets.assign(offsetsData, offsetsData + offsetCount);
+  refresh();
+  mapping.reset();
+}
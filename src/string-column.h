@@ -0,0 +1,107 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include "roaring/roaring.h"
+#include "snapshot.h"
+
+#ifndef MERLIN_STRING_COLUMN_H
+#define MERLIN_STRING_COLUMN_H
+
+using namespace std;
+
+// raw string column for high cardinality values.
+// strings are stored back to back in a single arena,
+// value of row id r is arena[offsets[r - 1], offsets[r]).
+// filters scan the arena instead of keeping per value bitmaps.
+class StringColumn {
+  public:
+  StringColumn() {
+    refresh();
+  }
+
+  // copy of a mapped column reads from the same mapping
+  StringColumn(const StringColumn &other): arena(other.arena), offsets(other.offsets), mapping(other.mapping) {
+    refresh();
+
+    if (mapping) {
+      arenaData = other.arenaData;
+      arenaSize = other.arenaSize;
+      offsetsData = other.offsetsData;
+      offsetCount = other.offsetCount;
+    }
+  }
+
+  StringColumn &operator=(const StringColumn &) = delete;
+
+  size_t size() const {
+    return offsetCount - 1;
+  }
+
+  void push_back(const string &value) {
+    if (mapping) {
+      thaw();
+    }
+
+    arena.insert(arena.end(), value.begin(), value.end());
+    offsets.push_back(arena.size());
+    refresh();
+  }
+
+  // value at given index, row id is index + 1
+  string operator[](size_t index) const {
+    return string(arenaData + offsetsData[index], offsetsData[index + 1] - offsetsData[index]);
+  }
+
+  // rows matching the filter. supported operators: =, !=, prefix, contains.
+  // caller owns the returned bitmap.
+  roaring_bitmap_t *match(const string &op, const string &value) const;
+
+  // memory owned by the column, mapped data excluded
+  int64_t statUsedMemory() const {
+    return arena.capacity() + sizeof(uint64_t) * offsets.capacity();
+  }
+
+  // releases unused capacity, mapped data is left as is
+  void shrinkToFit() {
+    if (mapping) {
+      return;
+    }
+
+    arena.shrink_to_fit();
+    offsets.shrink_to_fit();
+    refresh();
+  }
+
+  void save(SnapshotWriter &writer) const {
+    writer.writeArray(arenaData, arenaSize);
+    writer.writeArray(offsetsData, offsetCount);
+  }
+
+  // in zero copy mode the column reads from the mapping until it is appended to
+  void load(SnapshotReader &reader);
+
+  private:
+  vector<char> arena;
+  vector<uint64_t> offsets = {0};
+  // point either into the vectors above or into a mapped snapshot file
+  const char *arenaData;
+  uint64_t arenaSize;
+  const uint64_t *offsetsData;
+  uint64_t offsetCount;
+  shared_ptr<MappedFile> mapping;
+
+  void refresh() {
+    arenaData = arena.data();
+    arenaSize = arena.size();
+    offsetsData = offsets.data();
+    offsetCount = offsets.size();
+  }
+
+  // copies mapped data into owned vectors
+  void thaw();
+
+  void findSubstring(const string &value, vector<uint32_t> &rows) const;
+};
+
+#endif //MERLIN_STRING_COLUMN_H
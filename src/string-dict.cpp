@@ -0,0 +1,127 @@
+#include "string-dict.h"
+
+using namespace std;
+
+StringDict::StringDict(const StringDict &other): arena(other.arena), offsets(other.offsets), hashes(other.hashes), slots(other.slots) {
+  bitmaps.reserve(other.bitmaps.size());
+
+  for (auto &&bitmap : other.bitmaps) {
+    bitmaps.push_back(roaring_bitmap_copy(bitmap));
+  }
+}
+
+uint32_t StringDict::hash(const char *str, size_t len) {
+  // FNV-1a, folded to 32 bits
+  uint64_t h = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < len; i++) {
+    h ^= (uint8_t) str[i];
+    h *= 1099511628211ULL;
+  }
+
+  return (uint32_t) (h ^ (h >> 32));
+}
+
+uint32_t StringDict::find(const string &value) const {
+  const uint32_t mask = (uint32_t) slots.size() - 1;
+
+  for (uint32_t slot = hash(value.data(), value.size()) & mask; ; slot = (slot + 1) & mask) {
+    const uint32_t entry = slots[slot];
+
+    if (entry == 0) {
+      return NOT_FOUND;
+    }
+
+    if (equals(entry - 1, value)) {
+      return entry - 1;
+    }
+  }
+}
+
+uint32_t StringDict::getOrInsert(const string &value) {
+  const uint32_t h = hash(value.data(), value.size());
+  uint32_t mask = (uint32_t) slots.size() - 1;
+  uint32_t slot = h & mask;
+
+  for (; slots[slot] != 0; slot = (slot + 1) & mask) {
+    if (equals(slots[slot] - 1, value)) {
+      return slots[slot] - 1;
+    }
+  }
+
+  const auto id = (uint32_t) bitmaps.size();
+
+  arena.insert(arena.end(), value.begin(), value.end());
+  offsets.push_back(arena.size());
+  hashes.push_back(h);
+  bitmaps.push_back(roaring_bitmap_create());
+
+  // keep load factor under 0.5
+  if ((uint64_t) bitmaps.size() * 2 > slots.size()) {
+    grow();
+  } else {
+    slots[slot] = id + 1;
+  }
+
+  return id;
+}
+
+void StringDict::grow() {
+  slots.assign(slots.size() * 2, 0);
+  rehash();
+}
+
+void StringDict::rehash() {
+  const uint32_t mask = (uint32_t) slots.size() - 1;
+
+  for (uint32_t id = 0, len = (uint32_t) hashes.size(); id < len; id++) {
+    uint32_t slot = hashes[id] & mask;
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = id + 1;
+  }
+}
+
+void StringDict::save(SnapshotWriter &writer) const {
+  writer.writeVector(arena);
+  writer.writeVector(offsets);
+  writer.writeVector(hashes);
+
+  for (auto &&bitmap : bitmaps) {
+    writer.writeBitmap(bitmap);
+  }
+}
+
+void StringDict::load(SnapshotReader &reader) {
+  reader.readVector(arena);
+  reader.readVector(offsets);
+  reader.readVector(hashes);
+
+  bitmaps.reserve(hashes.size());
+  for (size_t i = 0; i < hashes.size(); i++) {
+    bitmaps.push_back(reader.readBitmap());
+  }
+
+  // smallest table keeping load factor under 0.5
+  size_t slotCount = INITIAL_SLOT_COUNT;
+  while (hashes.size() * 2 > slotCount) {
+    slotCount *= 2;
+  }
+
+  slots.assign(slotCount, 0);
+  rehash();
+}
+
+void DictIdColumn::widen(int newWidth) {
+  const auto count = size();
+  vector<uint8_t> widened(count * newWidth);
+
+  for (size_t i = 0; i < count; i++) {
+    const uint32_t id = (*this)[i];
+    memcpy(widened.data() + i * newWidth, &id, newWidth);
+  }
+
+  width = newWidth;
+  data.swap(widened);
+}
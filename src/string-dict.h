@@ -0,0 +1,153 @@
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include "roaring/roaring.h"
+#include "snapshot.h"
+
+#ifndef MERLIN_STRING_DICT_H
+#define MERLIN_STRING_DICT_H
+
+using namespace std;
+
+// dictionary of a string field.
+// every distinct value gets a dense id. strings are stored back to back
+// in a single arena and found through an open addressing hash table,
+// so ingest and filter lookups are one hash probe.
+class StringDict {
+  public:
+  static const uint32_t NOT_FOUND = UINT32_MAX;
+
+  // id > rows having the value
+  vector<roaring_bitmap_t *> bitmaps;
+
+  StringDict() {
+    slots.assign(INITIAL_SLOT_COUNT, 0);
+  }
+
+  // bitmaps are copied too
+  StringDict(const StringDict &other);
+  StringDict &operator=(const StringDict &) = delete;
+
+  ~StringDict() {
+    for (auto &&bitmap : bitmaps) {
+      roaring_bitmap_free(bitmap);
+    }
+  }
+
+  uint32_t size() const {
+    return (uint32_t) bitmaps.size();
+  }
+
+  // returns id of the value, adds it with an empty bitmap if missing
+  uint32_t getOrInsert(const string &value);
+
+  // returns id of the value or NOT_FOUND
+  uint32_t find(const string &value) const;
+
+  string str(uint32_t id) const {
+    return string(arena.data() + offsets[id], offsets[id + 1] - offsets[id]);
+  }
+
+  // memory used by dictionary structures, bitmaps excluded
+  int64_t statUsedMemory() const {
+    return arena.capacity()
+           + sizeof(uint64_t) * offsets.capacity()
+           + sizeof(uint32_t) * (hashes.capacity() + slots.capacity())
+           + sizeof(roaring_bitmap_t *) * bitmaps.capacity();
+  }
+
+  // releases unused capacity of dictionary structures, bitmaps excluded
+  void shrinkToFit() {
+    arena.shrink_to_fit();
+    offsets.shrink_to_fit();
+    hashes.shrink_to_fit();
+    bitmaps.shrink_to_fit();
+  }
+
+  // strings are written as a single blob, the hash table is rebuilt on load
+  void save(SnapshotWriter &writer) const;
+  // dictionary must be empty
+  void load(SnapshotReader &reader);
+
+  private:
+  static const uint32_t INITIAL_SLOT_COUNT = 16;
+
+  // strings, back to back
+  vector<char> arena;
+  // value of id i is arena[offsets[i], offsets[i + 1])
+  vector<uint64_t> offsets = {0};
+  // hash of every id, used while growing the table
+  vector<uint32_t> hashes;
+  // open addressing table of id + 1, 0 marks an empty slot.
+  // size is always a power of two.
+  vector<uint32_t> slots;
+
+  static uint32_t hash(const char *str, size_t len);
+
+  bool equals(uint32_t id, const string &value) const {
+    const auto len = offsets[id + 1] - offsets[id];
+    return len == value.size() && memcmp(arena.data() + offsets[id], value.data(), len) == 0;
+  }
+
+  void grow();
+
+  // fills slots from hashes, table size is kept as is
+  void rehash();
+};
+
+// dictionary id of every row of a dict encoded field.
+// ids are packed into 1, 2 or 4 bytes depending on dictionary size,
+// column is widened once the dictionary outgrows current width.
+class DictIdColumn {
+  public:
+  int width;
+  vector<uint8_t> data;
+
+  DictIdColumn(): width(1) {}
+
+  size_t size() const {
+    return data.size() / width;
+  }
+
+  void push_back(uint32_t id) {
+    if (width < 4 && id >= (1u << (8 * width))) {
+      widen(id < (1u << 16) ? 2 : 4);
+    }
+
+    const auto offset = data.size();
+    data.resize(offset + width);
+    memcpy(data.data() + offset, &id, width); // little endian
+  }
+
+  inline uint32_t operator[](size_t i) const {
+    switch (width) {
+      case 1: return data[i];
+      case 2: return ((const uint16_t *) data.data())[i];
+      default: return ((const uint32_t *) data.data())[i];
+    }
+  }
+
+  int64_t statUsedMemory() const {
+    return data.capacity();
+  }
+
+  void shrinkToFit() {
+    data.shrink_to_fit();
+  }
+
+  void save(SnapshotWriter &writer) const {
+    writer.writeValue(width);
+    writer.writeVector(data);
+  }
+
+  void load(SnapshotReader &reader) {
+    width = reader.readValue<int>();
+    reader.readVector(data);
+  }
+
+  private:
+  void widen(int newWidth);
+};
+
+#endif //MERLIN_STRING_DICT_H
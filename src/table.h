@@ -1,30 +1,497 @@
 #include <string>
 #include <vector>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+#include <time.h>
 
 #include "field.h"
+#include "segment.h"
+#include "rollup.h"
+#include "utils.h"
 
 #ifndef MERLIN_TABLE_H
 #define MERLIN_TABLE_H
 
 using namespace std;
 
+// rows of a table are kept by segments. new rows go to the head segment of
+// their partition, full segments are queued to be sealed in the background.
+// queries run on every segment separately.
+// tables partitioned on a timestamp field keep every hour or day in its own
+// segments, so time filters skip whole partitions and expired ones are dropped
+// from the front of partitions without touching rows or live segments.
+// rollups are kept next to rows and answer the queries they cover.
 class Table {
   public:
+  // field definitions, they never hold rows.
+  // every segment has its own empty copy of them to fill.
   map<string, Field *> fields;
-  uint32_t size; // record count
+  // segments of every partition in the order they were added, by partition start.
+  // tables without partitions keep all of them under 0.
+  map<int64_t, vector<Segment *>> partitions;
+  // segment receiving rows of each partition
+  map<int64_t, Segment *> heads;
+  // full segments waiting to be sealed, oldest first
+  deque<Segment *> fullSegments;
+  // full segment whose sealed copy is being built, see startSealing
+  Segment *sealing = nullptr;
+  uint64_t size = 0; // record count
+  uint32_t segmentRows;
+  // timestamp field rows are partitioned on and partition width in seconds.
+  // partitionSeconds is 0 for tables without partitions.
+  string partitionField;
+  int64_t partitionSeconds = 0;
+  // partitions ending this many seconds before now are dropped, 0 keeps them
+  int64_t retentionSeconds = 0;
+  vector<Rollup *> rollups;
+  // used to decide when to compact automatically
+  uint32_t rowsSinceCompaction = 0;
+  time_t lastInsertTime = 0;
+  // statUsedMemory when last measured plus an estimate for rows added since.
+  // memory limits are checked against it, so inserts do not walk segments.
+  // it is measured again on compaction, sealing and drops and whenever
+  // the table doubled since.
+  int64_t usedMemory = 0;
+
+  Table(uint32_t segmentRows_ = SEGMENT_ROWS): segmentRows(segmentRows_) {
+    addHead(0);
+    measureUsedMemory();
+  }
 
   ~Table() {
     for (auto &&it : fields) {
       delete it.second;
     }
+
+    for (auto &&partition : partitions) {
+      for (auto &&segment : partition.second) {
+        delete segment;
+      }
+    }
+
+    for (auto &&rollup : rollups) {
+      delete rollup;
+    }
+
+    totalUsedMemory() -= usedMemory;
+  }
+
+  // usedMemory of every table
+  static int64_t &totalUsedMemory() {
+    static int64_t total = 0;
+    return total;
+  }
+
+  void measureUsedMemory() {
+    const auto used = statUsedMemory();
+    totalUsedMemory() += used - usedMemory;
+    usedMemory = used;
+    measuredRows = size;
   }
 
   void setField(Field *field) {
+    if (size > 0) {
+      throw std::runtime_error("fields can not be added to a table having rows");
+    }
+
+    delete fields[field->name];
     fields[field->name] = field;
+
+    for (auto &&partition : partitions) {
+      for (auto &&segment : partition.second) {
+        delete segment->fields[field->name];
+        segment->setField(field->cloneDefinition());
+      }
+    }
+
+    measureUsedMemory();
+  }
+
+  // partitions rows on a timestamp field, must be called before any row is added
+  void setPartitioning(const string &field, int64_t seconds) {
+    if (size > 0) {
+      throw std::runtime_error("partitioning can not be changed on a table having rows");
+    }
+
+    if (fields.count(field) == 0 || fields[field]->type != FIELD_TYPE_TIMESTAMP) {
+      throw std::runtime_error("tables can only be partitioned on a timestamp field");
+    }
+
+    if (!rollups.empty()) {
+      throw std::runtime_error("partitioning must be set before rollups");
+    }
+
+    if (seconds <= 0) {
+      throw std::runtime_error("invalid partition width " + to_string(seconds));
+    }
+
+    for (auto &&partition : partitions) {
+      for (auto &&segment : partition.second) {
+        delete segment;
+      }
+    }
+
+    partitions.clear();
+    heads.clear();
+    fullSegments.clear();
+    partitionField = field;
+    partitionSeconds = seconds;
+    measureUsedMemory();
+  }
+
+  // takes ownership of a rollup, must be called before any row is added.
+  // rollups of restored tables are added before their segments.
+  void addRollup(Rollup *rollup) {
+    try {
+      if (size > 0) {
+        throw std::runtime_error("rollups can not be added to a table having rows");
+      }
+
+      for (auto &&existing : rollups) {
+        if (existing->name == rollup->name) {
+          throw std::runtime_error("rollup " + rollup->name + " already exists");
+        }
+      }
+
+      if (fields.count(rollup->timeField) == 0 || fields[rollup->timeField]->type != FIELD_TYPE_TIMESTAMP) {
+        throw std::runtime_error("rollup " + rollup->name + ": time field must be a timestamp field");
+      }
+
+      // retention drops whole partitions, buckets must not straddle them
+      if (partitionSeconds > 0 && (rollup->timeField != partitionField || partitionSeconds % rollup->granularity != 0)) {
+        throw std::runtime_error("rollup " + rollup->name + ": buckets must divide partitions of " + partitionField);
+      }
+
+      for (auto &&dimension : rollup->dimensions) {
+        const auto it = fields.find(dimension);
+        if (it == fields.end() || !(it->second->type == FIELD_TYPE_BOOLEAN || (it->second->type == FIELD_TYPE_STRING && it->second->encoding == FIELD_ENCODING_DICT))) {
+          throw std::runtime_error("rollup " + rollup->name + ": dimensions must be dict encoded string or boolean fields");
+        }
+      }
+
+      for (auto &&metric : rollup->metrics) {
+        const auto it = fields.find(metric.field);
+        if (it == fields.end()) {
+          throw std::runtime_error("rollup " + rollup->name + ": unknown metric field " + metric.field);
+        }
+        // distinct counts are kept for any field, other metrics for numbers
+        if (metric.func != "approx_count_distinct" && it->second->type != FIELD_TYPE_INT && it->second->type != FIELD_TYPE_BIGINT) {
+          throw std::runtime_error("rollup " + rollup->name + ": " + metric.func + " metrics must be int or bigint fields");
+        }
+        metric.type = it->second->type;
+      }
+    } catch (...) {
+      delete rollup;
+      throw;
+    }
+
+    rollups.push_back(rollup);
+    measureUsedMemory();
+  }
+
+  // partition a row having given timestamp belongs to
+  int64_t partitionOf(int64_t timestamp) const {
+    if (partitionSeconds == 0) {
+      return 0;
+    }
+
+    return timeBucketStart(timestamp, partitionSeconds);
+  }
+
+  // whether rows of a partition may have timestamps in [from, to)
+  bool partitionOverlaps(int64_t partition, int64_t from, int64_t to) const {
+    return partitionSeconds == 0 || (from < partition + partitionSeconds && to > partition);
+  }
+
+  // segment new rows of a partition go to
+  Segment *head(int64_t partition = 0) {
+    const auto it = heads.find(partition);
+
+    if (it == heads.end() || it->second->size >= segmentRows || it->second->sealed) {
+      return addHead(partition);
+    }
+
+    return it->second;
+  }
+
+  // count rows whose values were added to the fields of head(partition)
+  void addRows(uint32_t count, int64_t partition = 0) {
+    const auto segment = heads[partition];
+    segment->size += count;
+    size += count;
+    rowsSinceCompaction += count;
+
+    if (segment->size >= segmentRows) {
+      addHead(partition);
+    }
+
+    // new rows are assumed to be as large as the measured ones on average
+    if (size >= 2 * measuredRows) {
+      measureUsedMemory();
+    } else {
+      const int64_t growth = usedMemory / (int64_t) (size - count) * count;
+      usedMemory += growth;
+      totalUsedMemory() += growth;
+    }
   }
 
   void incrementRecordCount() {
-    size++;
+    addRows(1);
+  }
+
+  // takes over segments restored from a snapshot.
+  // field definitions and partitioning must be set before.
+  void setSegments(const vector<Segment *> &restored) {
+    for (auto &&partition : partitions) {
+      for (auto &&segment : partition.second) {
+        delete segment;
+      }
+    }
+
+    partitions.clear();
+    heads.clear();
+    fullSegments.clear();
+    size = 0;
+
+    for (auto &&segment : restored) {
+      partitions[segment->partition].push_back(segment);
+      size += segment->size;
+      if (segment->sealed) {
+        segment->sealedMemory = segment->statUsedMemory();
+        continue;
+      }
+
+      // the last unsealed segment of a partition keeps receiving rows
+      const auto it = heads.find(segment->partition);
+      if (it != heads.end()) {
+        fullSegments.push_back(it->second);
+      }
+      heads[segment->partition] = segment;
+    }
+
+    if (partitionSeconds == 0 && heads.empty()) {
+      addHead(0);
+    }
+
+    measureUsedMemory();
+  }
+
+  // removes partitions ending before given time, returns dropped row count.
+  // partitions are ordered by start, so only dropped ones are visited.
+  uint64_t dropPartitionsBefore(int64_t time) {
+    uint64_t dropped = 0;
+
+    if (partitionSeconds == 0 || partitions.empty() || partitions.begin()->first + partitionSeconds > time) {
+      return 0;
+    }
+
+    fullSegments.erase(std::remove_if(fullSegments.begin(), fullSegments.end(), [this, time](Segment *segment) {
+      return segment->partition + partitionSeconds <= time;
+    }), fullSegments.end());
+
+    while (!partitions.empty() && partitions.begin()->first + partitionSeconds <= time) {
+      for (auto &&segment : partitions.begin()->second) {
+        if (sealing == segment) {
+          sealing = nullptr;
+        }
+        dropped += segment->size;
+        delete segment;
+      }
+
+      heads.erase(partitions.begin()->first);
+      partitions.erase(partitions.begin());
+    }
+
+    size -= dropped;
+
+    // buckets of dropped partitions, they start before the first kept partition
+    if (time >= INT64_MIN + partitionSeconds) {
+      for (auto &&rollup : rollups) {
+        rollup->dropBefore(partitionOf(time - partitionSeconds) + partitionSeconds);
+      }
+    }
+
+    measureUsedMemory();
+
+    return dropped;
+  }
+
+  // drops partitions older than retentionSeconds, returns dropped row count
+  uint64_t dropExpiredPartitions(int64_t now) {
+    return retentionSeconds > 0 ? dropPartitionsBefore(now - retentionSeconds) : 0;
+  }
+
+  size_t partitionCount() const {
+    return partitions.size();
+  }
+
+  size_t segmentCount() const {
+    size_t count = 0;
+
+    for (auto &&partition : partitions) {
+      count += partition.second.size();
+    }
+
+    return count;
+  }
+
+  // every segment, oldest partition first
+  vector<Segment *> allSegments() const {
+    vector<Segment *> segments;
+
+    for (auto &&partition : partitions) {
+      segments.insert(segments.end(), partition.second.begin(), partition.second.end());
+    }
+
+    return segments;
+  }
+
+  bool hasFullSegments() {
+    return !fullSegments.empty();
+  }
+
+  // seals full segments in place, returns reclaimed bytes
+  int64_t sealFullSegments() {
+    int64_t reclaimed = 0;
+
+    if (fullSegments.empty()) {
+      return 0;
+    }
+
+    for (; !fullSegments.empty(); fullSegments.pop_front()) {
+      reclaimed += fullSegments.front()->seal();
+    }
+
+    measureUsedMemory();
+
+    return reclaimed;
+  }
+
+  // takes the oldest full segment, whose sealed copy is then built without
+  // the server lock. returns null when there is none. mapped segments are
+  // sealed in place instead, compaction leaves their mapped data as is.
+  Segment *startSealing() {
+    while (!fullSegments.empty()) {
+      const auto segment = fullSegments.front();
+      fullSegments.pop_front();
+
+      if (!segment->isMapped()) {
+        sealing = segment;
+        return segment;
+      }
+
+      segment->seal();
+      measureUsedMemory();
+    }
+
+    return nullptr;
+  }
+
+  // swaps in the sealed copy of the segment taken by startSealing.
+  // the copy is discarded when its segment was dropped meanwhile.
+  void finishSealing(Segment *sealed) {
+    if (sealing == nullptr) {
+      delete sealed;
+      return;
+    }
+
+    auto &segments = partitions[sealing->partition];
+    *std::find(segments.begin(), segments.end(), sealing) = sealed;
+    delete sealing;
+    sealing = nullptr;
+    measureUsedMemory();
+  }
+
+  // memory owned by the table and its segments.
+  // sealed segments count what they were measured at.
+  int64_t statUsedMemory() {
+    int64_t sum = sizeof(Table) + partitionField.capacity();
+
+    for (auto &&it : fields) {
+      sum += MAP_NODE_OVERHEAD + sizeof(it) + it.first.capacity() + it.second->statUsedMemory();
+    }
+
+    sum += (MAP_NODE_OVERHEAD + sizeof(pair<int64_t, Segment *>)) * heads.size();
+    sum += sizeof(Segment *) * fullSegments.size();
+
+    for (auto &&partition : partitions) {
+      sum += MAP_NODE_OVERHEAD + sizeof(partition) + sizeof(Segment *) * partition.second.capacity();
+      for (auto &&segment : partition.second) {
+        sum += segment->sealed ? segment->sealedMemory : segment->statUsedMemory();
+      }
+    }
+
+    sum += sizeof(Rollup *) * rollups.capacity();
+
+    for (auto &&rollup : rollups) {
+      sum += rollup->statUsedMemory();
+    }
+
+    return sum;
+  }
+
+  // memory owned by a field in every segment
+  int64_t statFieldUsedMemory(const string &name) {
+    int64_t sum = 0;
+
+    for (auto &&partition : partitions) {
+      for (auto &&segment : partition.second) {
+        sum += segment->fields[name]->statUsedMemory();
+      }
+    }
+
+    return sum;
+  }
+
+  int64_t statFieldMappedMemory(const string &name) {
+    int64_t sum = 0;
+
+    for (auto &&partition : partitions) {
+      for (auto &&segment : partition.second) {
+        sum += segment->fields[name]->statMappedMemory();
+      }
+    }
+
+    return sum;
+  }
+
+  // seals full segments and compacts heads, returns reclaimed bytes
+  int64_t compact() {
+    int64_t reclaimed = sealFullSegments();
+
+    for (auto &&it : heads) {
+      reclaimed += it.second->compact();
+    }
+
+    rowsSinceCompaction = 0;
+    measureUsedMemory();
+
+    return reclaimed;
+  }
+
+  private:
+  // table size when usedMemory was last measured
+  uint64_t measuredRows = 0;
+
+  Segment *addHead(int64_t partition) {
+    const auto previous = heads.find(partition);
+    auto segment = new Segment();
+
+    if (previous != heads.end() && !previous->second->sealed) {
+      fullSegments.push_back(previous->second);
+    }
+
+    segment->partition = partition;
+
+    for (auto &&it : fields) {
+      segment->setField(it.second->cloneDefinition());
+    }
+
+    partitions[partition].push_back(segment);
+    heads[partition] = segment;
+
+    return segment;
   }
 };
 
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include "thread-pool.h"
+
+ThreadPool::ThreadPool(size_t threads_): job(nullptr), jobWorkers(0), generation(0), running(0), stopping(false), failed(false) {
+  for (size_t i = 0; i <= threads_; i++) {
+    queues.emplace_back(new TaskQueue());
+  }
+
+  for (size_t i = 1; i <= threads_; i++) {
+    threads.emplace_back(&ThreadPool::workerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+
+  wake.notify_all();
+
+  for (auto &&thread_ : threads) {
+    thread_.join();
+  }
+}
+
+void ThreadPool::run(size_t taskCount, size_t workers, const function<void(size_t task, size_t worker)> &fn) {
+  lock_guard<mutex> jobGuard(jobLock);
+
+  workers = std::max((size_t) 1, std::min(workers, std::min(size(), taskCount)));
+
+  // neighbouring tasks go to the same worker
+  for (size_t worker = 0; worker < workers; worker++) {
+    auto &queue = *queues[worker];
+    lock_guard<mutex> guard(queue.lock);
+    for (size_t task = taskCount * worker / workers; task < taskCount * (worker + 1) / workers; task++) {
+      queue.tasks.push_back(task);
+    }
+  }
+
+  {
+    lock_guard<mutex> guard(lock);
+    job = &fn;
+    jobWorkers = workers;
+    running = workers;
+    failed = false;
+    error = nullptr;
+    generation++;
+  }
+
+  wake.notify_all();
+  work(0);
+
+  unique_lock<mutex> guard(lock);
+  done.wait(guard, [&] { return running == 0; });
+  job = nullptr;
+
+  if (error) {
+    rethrow_exception(error);
+  }
+}
+
+void ThreadPool::workerLoop(size_t worker) {
+  uint64_t seen = 0;
+
+  while (true) {
+    {
+      unique_lock<mutex> guard(lock);
+      wake.wait(guard, [&] { return stopping || generation != seen; });
+
+      if (stopping) {
+        return;
+      }
+
+      seen = generation;
+
+      if (worker >= jobWorkers) {
+        continue;
+      }
+    }
+
+    work(worker);
+  }
+}
+
+void ThreadPool::work(size_t worker) {
+  size_t task;
+
+  while (nextTask(worker, task)) {
+    if (failed) {
+      continue;
+    }
+
+    try {
+      (*job)(task, worker);
+    } catch (...) {
+      lock_guard<mutex> guard(lock);
+      if (!error) {
+        error = current_exception();
+      }
+      failed = true;
+    }
+  }
+
+  lock_guard<mutex> guard(lock);
+
+  if (--running == 0) {
+    done.notify_one();
+  }
+}
+
+bool ThreadPool::nextTask(size_t worker, size_t &task) {
+  {
+    auto &own = *queues[worker];
+    lock_guard<mutex> guard(own.lock);
+    if (!own.tasks.empty()) {
+      task = own.tasks.front();
+      own.tasks.pop_front();
+      return true;
+    }
+  }
+
+  // tasks are never added while a job runs, so once every queue is empty the worker is done
+  for (size_t i = 1; i < jobWorkers; i++) {
+    auto &victim = *queues[(worker + i) % jobWorkers];
+    lock_guard<mutex> guard(victim.lock);
+    if (!victim.tasks.empty()) {
+      task = victim.tasks.back();
+      victim.tasks.pop_back();
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,62 @@
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <memory>
+
+#ifndef MERLIN_THREAD_POOL_H
+#define MERLIN_THREAD_POOL_H
+
+using namespace std;
+
+// fixed set of threads running the tasks of one job at a time.
+// tasks are dealt to per worker queues up front, a worker running out
+// of tasks steals from the back of the queues of the others.
+class ThreadPool {
+  public:
+  // the thread calling run works too, so threads are started in addition to it
+  explicit ThreadPool(size_t threads);
+  ~ThreadPool();
+
+  // most workers a job can have
+  size_t size() const {
+    return threads.size() + 1;
+  }
+
+  // runs fn(task, worker) for every task in [0, taskCount) on up to workers
+  // workers, worker indexes are in [0, workers). returns once all tasks ran.
+  // after a task throws the remaining ones are skipped and the first exception is rethrown.
+  void run(size_t taskCount, size_t workers, const function<void(size_t task, size_t worker)> &fn);
+
+  private:
+  struct TaskQueue {
+    mutex lock;
+    deque<size_t> tasks;
+  };
+
+  vector<thread> threads;
+  vector<unique_ptr<TaskQueue>> queues;
+  // one job at a time
+  mutex jobLock;
+  // guards the fields of the current job below
+  mutex lock;
+  condition_variable wake;
+  condition_variable done;
+  const function<void(size_t task, size_t worker)> *job;
+  size_t jobWorkers;
+  uint64_t generation;
+  size_t running;
+  bool stopping;
+  atomic<bool> failed;
+  exception_ptr error;
+
+  void workerLoop(size_t worker);
+  void work(size_t worker);
+  bool nextTask(size_t worker, size_t &task);
+};
+
+#endif //MERLIN_THREAD_POOL_H
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include "timestamp-index.h"
+
+using namespace std;
+
+// first index in [lo, hi) whose timestamp is >= value
+static size_t lowerBound(const PackedColumn &timestamps, size_t lo, size_t hi, int64_t value) {
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+
+    if (timestamps[mid] < value) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+void TimestampIndex::add(const PackedColumn &timestamps, int64_t value) {
+  const auto index = timestamps.size() - 1;
+  const auto block = index / BLOCK_SIZE;
+
+  if (block == blockMin.size()) {
+    blockMin.push_back(value);
+    blockMax.push_back(value);
+    blockSorted.push_back(true);
+  } else {
+    blockMin[block] = std::min(blockMin[block], value);
+    blockMax[block] = std::max(blockMax[block], value);
+  }
+
+  if (index > 0 && timestamps[index - 1] > value) {
+    sorted = false;
+
+    if (index % BLOCK_SIZE != 0) {
+      blockSorted[block] = false;
+    }
+  }
+}
+
+int64_t TimestampIndex::minValue() {
+  if (blockMin.empty()) {
+    return 0;
+  }
+
+  return *std::min_element(blockMin.begin(), blockMin.end());
+}
+
+int64_t TimestampIndex::maxValue() {
+  if (blockMax.empty()) {
+    return 0;
+  }
+
+  return *std::max_element(blockMax.begin(), blockMax.end());
+}
+
+roaring_bitmap_t *TimestampIndex::range(const PackedColumn &timestamps, int64_t from, int64_t to) {
+  if (timestamps.empty() || from >= to) {
+    return roaring_bitmap_create();
+  }
+
+  // row ids start from 1
+  if (sorted) {
+    const auto lo = lowerBound(timestamps, 0, timestamps.size(), from);
+    const auto hi = lowerBound(timestamps, lo, timestamps.size(), to);
+
+    if (lo == hi) {
+      return roaring_bitmap_create();
+    }
+
+    return roaring_bitmap_from_range((uint64_t) lo + 1, (uint64_t) hi + 1, 1);
+  }
+
+  auto result = roaring_bitmap_create();
+
+  for (size_t block = 0, blockCount = blockMin.size(); block < blockCount; block++) {
+    if (blockMax[block] < from || blockMin[block] >= to) {
+      continue;
+    }
+
+    const auto start = block * BLOCK_SIZE;
+    const auto end = std::min(start + BLOCK_SIZE, timestamps.size());
+
+    if (blockMin[block] >= from && blockMax[block] < to) {
+      roaring_bitmap_add_range(result, (uint64_t) start + 1, (uint64_t) end + 1);
+      continue;
+    }
+
+    if (blockSorted[block]) {
+      const auto lo = lowerBound(timestamps, start, end, from);
+      const auto hi = lowerBound(timestamps, lo, end, to);
+
+      if (lo < hi) {
+        roaring_bitmap_add_range(result, (uint64_t) lo + 1, (uint64_t) hi + 1);
+      }
+      continue;
+    }
+
+    for (auto i = start; i < end; i++) {
+      const auto timestamp = timestamps[i];
+      if (timestamp >= from && timestamp < to) {
+        roaring_bitmap_add(result, (uint32_t) i + 1);
+      }
+    }
+  }
+
+  roaring_bitmap_run_optimize(result);
+
+  return result;
+}
+
+void TimestampIndex::save(SnapshotWriter &writer) const {
+  writer.writeValue((uint8_t) sorted);
+  writer.writeVector(blockMin);
+  writer.writeVector(blockMax);
+  writer.writeVector(vector<uint8_t>(blockSorted.begin(), blockSorted.end()));
+}
+
+void TimestampIndex::load(SnapshotReader &reader) {
+  vector<uint8_t> sortedBlocks;
+
+  sorted = reader.readValue<uint8_t>() != 0;
+  reader.readVector(blockMin);
+  reader.readVector(blockMax);
+  reader.readVector(sortedBlocks);
+  blockSorted.assign(sortedBlocks.begin(), sortedBlocks.end());
+}
@@ -0,0 +1,53 @@
+#include <vector>
+#include <stdint.h>
+#include "roaring/roaring.h"
+#include "packed-column.h"
+#include "snapshot.h"
+
+#ifndef MERLIN_TIMESTAMP_INDEX_H
+#define MERLIN_TIMESTAMP_INDEX_H
+
+using namespace std;
+
+// maps time range predicates on a timestamp column to row id runs.
+// events mostly arrive in timestamp order, so while the column stays sorted
+// a range is found with two binary searches. once an out of order value
+// arrives we fall back to per-block min/max and only scan the blocks
+// which partially overlap the range.
+class TimestampIndex {
+  public:
+  static const uint32_t BLOCK_SIZE = 4096;
+
+  // true while every appended timestamp is >= the previous one
+  bool sorted;
+  vector<int64_t> blockMin;
+  vector<int64_t> blockMax;
+  vector<bool> blockSorted;
+
+  TimestampIndex(): sorted(true) {}
+
+  // must be called after timestamps.push_back(value)
+  void add(const PackedColumn &timestamps, int64_t value);
+
+  // rows whose timestamp is in [from, to). caller owns the returned bitmap.
+  roaring_bitmap_t *range(const PackedColumn &timestamps, int64_t from, int64_t to);
+
+  // smallest / largest timestamp in the column, 0 when empty
+  int64_t minValue();
+  int64_t maxValue();
+
+  int64_t statUsedMemory() {
+    return sizeof(int64_t) * (blockMin.capacity() + blockMax.capacity()) + blockSorted.capacity() / 8;
+  }
+
+  void shrinkToFit() {
+    blockMin.shrink_to_fit();
+    blockMax.shrink_to_fit();
+    blockSorted.shrink_to_fit();
+  }
+
+  void save(SnapshotWriter &writer) const;
+  void load(SnapshotReader &reader);
+};
+
+#endif //MERLIN_TIMESTAMP_INDEX_H
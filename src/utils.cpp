@@ -1,3 +1,4 @@
+#include "roaring/containers/containers.h"
 #include "utils.h"
 
 using namespace std;
@@ -15,3 +16,42 @@ void dumpStrVector(vector<string> vec) {
     i++;
   }
 }
+
+// roaring_bitmap_size_in_bytes gives the serialized size,
+// which ignores container slack, so containers are walked by hand
+int64_t bitmapUsedMemory(const roaring_bitmap_t *r) {
+  const auto &ra = r->high_low_container;
+  // keys, container pointers and typecodes
+  int64_t sum = sizeof(roaring_bitmap_t) + (int64_t) ra.allocation_size * (sizeof(uint16_t) + sizeof(void *) + sizeof(uint8_t));
+
+  for (int i = 0; i < ra.size; i++) {
+    uint8_t typecode;
+    void *cont = ra_get_container_at_index(&ra, i, &typecode);
+
+    // shared containers are counted at every owner
+    if (typecode == SHARED_CONTAINER_TYPE_CODE) {
+      sum += sizeof(shared_container_t);
+      typecode = ((shared_container_t *) cont)->typecode;
+      cont = ((shared_container_t *) cont)->container;
+    }
+
+    switch (typecode) {
+      case BITSET_CONTAINER_TYPE_CODE: {
+        sum += sizeof(bitset_container_t);
+        sum += sizeof(uint64_t) * BITSET_CONTAINER_SIZE_IN_WORDS;
+      } break;
+      case ARRAY_CONTAINER_TYPE_CODE: {
+        sum += sizeof(array_container_t);
+        sum += sizeof(uint16_t) * ((array_container_t *)cont)->capacity;
+      } break;
+      case RUN_CONTAINER_TYPE_CODE: {
+        sum += sizeof(run_container_t);
+        sum += sizeof(rle16_t) * ((run_container_t *)cont)->capacity;
+      } break;
+      default:
+        cout << "bitmapUsedMemory(): skipping unknown container type: " << (int) typecode << endl;
+    }
+  }
+
+  return sum;
+}
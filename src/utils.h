@@ -5,6 +5,8 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <stdint.h>
+#include "roaring/roaring.h"
 
 #ifndef MERLIN_UTILS_H
 #define MERLIN_UTILS_H
@@ -13,4 +15,19 @@ using namespace std;
 
 void dumpStrVector(vector<string> vec);
 
+// bookkeeping of a std::map node on top of its key and value:
+// color, parent, left and right pointers
+const int64_t MAP_NODE_OVERHEAD = 4 * sizeof(void *);
+
+// memory allocated by a bitmap, container slack included
+int64_t bitmapUsedMemory(const roaring_bitmap_t *r);
+
+// start of the time bucket of given width a timestamp falls into.
+// buckets are floored, so none of them straddles zero. dateSecondsGroup,
+// rollups and partitions all use it, so their buckets line up.
+inline int64_t timeBucketStart(int64_t timestamp, int64_t width) {
+  const int64_t offset = timestamp % width;
+  return timestamp - (offset < 0 ? offset + width : offset);
+}
+
 #endif //MERLIN_UTILS_H
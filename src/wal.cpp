@@ -0,0 +1,217 @@
+#include <stdexcept>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "wal.h"
+
+using namespace std;
+
+// length, crc, sequence, type
+static const size_t WAL_HEADER_SIZE = 4 + 4 + 8 + 1;
+// larger lengths can only come from a torn header
+static const uint32_t WAL_MAX_RECORD_SIZE = 1u << 30;
+
+WriteAheadLog::WriteAheadLog(const string &path_, int64_t commitWindowUs_): path(path_), commitWindowUs(commitWindowUs_) {
+  nextSequence = 1;
+  durable = 0;
+  syncing = false;
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+
+  if (fd < 0) {
+    throw std::runtime_error("could not open " + path + ": " + strerror(errno));
+  }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  close(fd);
+}
+
+static bool readFully(int fd, char *data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = read(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+void WriteAheadLog::replay(uint64_t afterSequence, function<void(uint8_t type, const string &payload)> callback) {
+  uint64_t lastSequence = afterSequence;
+  off_t validSize = 0;
+  char header[WAL_HEADER_SIZE];
+  string payload;
+
+  if (lseek(fd, 0, SEEK_SET) < 0) {
+    throw std::runtime_error("could not read " + path + ": " + strerror(errno));
+  }
+
+  while (readFully(fd, header, WAL_HEADER_SIZE)) {
+    uint32_t length, crc;
+    uint64_t sequence;
+    memcpy(&length, header, 4);
+    memcpy(&crc, header + 4, 4);
+    memcpy(&sequence, header + 8, 8);
+    const uint8_t type = (uint8_t) header[16];
+
+    if (length > WAL_MAX_RECORD_SIZE) {
+      break;
+    }
+
+    payload.resize(length);
+
+    if (!readFully(fd, &payload[0], length)) {
+      break;
+    }
+
+    uLong expected = crc32(0L, (const Bytef *) header + 8, WAL_HEADER_SIZE - 8);
+    expected = crc32(expected, (const Bytef *) payload.data(), length);
+
+    if ((uint32_t) expected != crc) {
+      break;
+    }
+
+    validSize += WAL_HEADER_SIZE + length;
+
+    if (sequence > afterSequence) {
+      callback(type, payload);
+    }
+
+    lastSequence = max(lastSequence, sequence);
+  }
+
+  if (ftruncate(fd, validSize) != 0 || fsync(fd) != 0) {
+    throw std::runtime_error("could not truncate " + path + ": " + strerror(errno));
+  }
+
+  lock_guard<mutex> guard(lock);
+  nextSequence = lastSequence + 1;
+  durable = lastSequence;
+}
+
+uint64_t WriteAheadLog::append(uint8_t type, const string &payload) {
+  lock_guard<mutex> guard(lock);
+
+  if (!failure.empty()) {
+    throw std::runtime_error(failure);
+  }
+
+  const uint64_t sequence = nextSequence++;
+  const uint32_t length = (uint32_t) payload.size();
+  char header[WAL_HEADER_SIZE];
+  memcpy(header, &length, 4);
+  memcpy(header + 8, &sequence, 8);
+  header[16] = (char) type;
+
+  uLong crc = crc32(0L, (const Bytef *) header + 8, WAL_HEADER_SIZE - 8);
+  crc = crc32(crc, (const Bytef *) payload.data(), length);
+  const uint32_t crc32Val = (uint32_t) crc;
+  memcpy(header + 4, &crc32Val, 4);
+
+  buffer.append(header, WAL_HEADER_SIZE);
+  buffer.append(payload);
+
+  return sequence;
+}
+
+void WriteAheadLog::writeAll(const string &data) {
+  size_t written = 0;
+
+  while (written < data.size()) {
+    const ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      throw std::runtime_error("could not write " + path + ": " + strerror(errno));
+    }
+    written += n;
+  }
+
+  if (fdatasync(fd) != 0) {
+    throw std::runtime_error("could not sync " + path + ": " + strerror(errno));
+  }
+}
+
+void WriteAheadLog::waitDurable(uint64_t sequence) {
+  unique_lock<mutex> guard(lock);
+
+  while (durable < sequence) {
+    if (!failure.empty()) {
+      throw std::runtime_error(failure);
+    }
+
+    if (syncing) {
+      synced.wait(guard);
+      continue;
+    }
+
+    // become the leader, records appended during the window join this sync
+    syncing = true;
+
+    if (commitWindowUs > 0) {
+      guard.unlock();
+      this_thread::sleep_for(chrono::microseconds(commitWindowUs));
+      guard.lock();
+    }
+
+    string data;
+    data.swap(buffer);
+    const uint64_t target = nextSequence - 1;
+    guard.unlock();
+
+    string err;
+    try {
+      writeAll(data);
+    } catch (std::runtime_error &e) {
+      err = e.what();
+    }
+
+    guard.lock();
+    syncing = false;
+
+    if (err.empty()) {
+      durable = target;
+    } else {
+      // part of the data may be on disk already, appending more
+      // would leave a gap in the log
+      failure = err;
+    }
+
+    synced.notify_all();
+  }
+}
+
+uint64_t WriteAheadLog::lastSequence() {
+  lock_guard<mutex> guard(lock);
+  return nextSequence - 1;
+}
+
+uint64_t WriteAheadLog::durableSequence() {
+  lock_guard<mutex> guard(lock);
+  return durable;
+}
+
+void WriteAheadLog::truncate() {
+  lock_guard<mutex> guard(lock);
+
+  if (!buffer.empty() || syncing) {
+    throw std::runtime_error("write ahead log has records not on disk");
+  }
+
+  if (ftruncate(fd, 0) != 0 || fsync(fd) != 0) {
+    failure = string("could not truncate ") + path + ": " + strerror(errno);
+    throw std::runtime_error(failure);
+  }
+}
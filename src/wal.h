@@ -0,0 +1,62 @@
+#include <string>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#ifndef MERLIN_WAL_H
+#define MERLIN_WAL_H
+
+using namespace std;
+
+// append only log of changes not yet in a snapshot.
+// every record is
+//   u32 payload length, u32 crc32 of the rest, u64 sequence, u8 type, payload
+// appends are buffered in memory and written by waitDurable. concurrent
+// waiters share one write and fdatasync, the first one becomes the leader
+// and waits commitWindowUs for others to join before syncing.
+class WriteAheadLog {
+  public:
+  WriteAheadLog(const string &path_, int64_t commitWindowUs_);
+  ~WriteAheadLog();
+
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  // calls callback for every record having a sequence above afterSequence.
+  // a torn record at the end, left by a crash during a write, is cut off.
+  // must be called once, before the first append.
+  void replay(uint64_t afterSequence, function<void(uint8_t type, const string &payload)> callback);
+
+  // buffers a record, returns its sequence
+  uint64_t append(uint8_t type, const string &payload);
+
+  // blocks until the record with given sequence is on disk.
+  // throws once a write or sync failed, the log is unusable after that.
+  void waitDurable(uint64_t sequence);
+
+  uint64_t lastSequence();
+
+  uint64_t durableSequence();
+
+  // drops every record. caller makes sure all of them are durable
+  // and saved in a snapshot. sequences keep growing.
+  void truncate();
+
+  private:
+  string path;
+  int64_t commitWindowUs;
+  int fd;
+  mutex lock;
+  condition_variable synced;
+  // records appended but not written yet
+  string buffer;
+  uint64_t nextSequence;
+  uint64_t durable;
+  bool syncing;
+  string failure;
+
+  void writeAll(const string &data);
+};
+
+#endif //MERLIN_WAL_H